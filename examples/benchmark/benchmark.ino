@@ -0,0 +1,64 @@
+/*
+ * Project VDW_Stepper
+ * Description: Scheduler scaling benchmark. Runs 1 to 32 steppers at constant speed and measures the
+ *   share of CPU time spent in Run_ISR() by comparing how often a busy loop runs against an idle run.
+ *   With the due-time heap the cost per step should stay flat as steppers are added.
+ * Author:
+ * Date:
+ */
+
+#include "VDW_Stepper.h"
+
+#define BENCHMARK_STEPPERS 32 // each stepper is ~1.2KB of RAM, mostly its move queue and commands, 32 fit the Photon
+#define STEPS_PER_SECOND 200 // speed of the first stepper, each stepper runs a little faster than the last
+#define MEASURE_TIME 2000 // ms
+
+VDW_Stepper steppers[BENCHMARK_STEPPERS];
+volatile uint32_t stepCount = 0;
+
+SYSTEM_MODE(MANUAL);
+
+// Busy Loop
+// Counts iterations of an empty loop for duration (ms)
+uint32_t busyLoop(uint32_t duration){
+  uint32_t count = 0;
+  uint32_t start = millis();
+  while(millis() - start < duration) count++;
+  return count;
+}
+
+void setup() {
+  Serial.begin(230400);
+  delay(5000);
+
+  for(uint8_t i=0; i<BENCHMARK_STEPPERS; i++){
+    steppers[i].init([](){ stepCount += 1; }, [](){ stepCount += 1; });
+  }
+
+  uint32_t idleCount = busyLoop(MEASURE_TIME);
+
+  Serial.printlnf("\n****************\nScheduler Benchmark\n****************\n");
+  Serial.printlnf("Steppers  Steps/sec  ISR load  usec/step");
+  for(uint8_t numSteppers=1; numSteppers<=BENCHMARK_STEPPERS; numSteppers*=2){
+    // Staggered speeds so deadlines do not line up
+    for(uint8_t i=0; i<numSteppers; i++){
+      steppers[i].run(ConstantSpeed, (STEPS_PER_SECOND + i*7) * 1000);
+    }
+    delay(100);
+
+    stepCount = 0;
+    uint32_t busyCount = busyLoop(MEASURE_TIME);
+    uint32_t steps = stepCount;
+
+    for(uint8_t i=0; i<numSteppers; i++){
+      steppers[i].stop();
+    }
+    delay(100);
+
+    float load = 1.0 - (float)busyCount / idleCount;
+    Serial.printlnf("%8d  %9lu  %7.2f%%  %9.2f", numSteppers, steps * 1000 / MEASURE_TIME, load * 100, load * MEASURE_TIME * 1000 / steps);
+  }
+}
+
+void loop() {
+}
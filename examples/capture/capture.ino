@@ -0,0 +1,43 @@
+/*
+ * Project VDW_Stepper
+ * Description: Step capture. Build with STEP_CAPTURE defined. Three motors run together, one at constant
+ *   speed, one through acceleration moves back and forth and one at a speed that is not a whole number of
+ *   u-sec per step, while every step is captured and printed. Save the Serial output on a PC and run:
+ *     ./capture_analyzer --speed 0=4000 < serial.log
+ *   to see how far each step was from the commanded profile (see examples/capture_analyzer).
+ * Author:
+ * Date:
+ */
+
+#include "VDW_Stepper.h"
+
+#define CAPTURE_MS 5000
+
+VDW_Stepper xAxis;
+VDW_Stepper yAxis;
+VDW_Stepper zAxis;
+uint32_t captureStart;
+
+SYSTEM_MODE(MANUAL);
+
+void setup() {
+  Serial.begin(921600); // the dump is ~20 KB/sec at these speeds
+
+  xAxis.initPins(D0, D1);
+  yAxis.initPins(D2, D3);
+  zAxis.initPins(D4, D5);
+  yAxis.setMode(Accelerations);
+  yAxis.setAcceleration(20000*1000);
+
+  Serial.printlnf("slots x %u, y %u, z %u", xAxis.getSlot(), yAxis.getSlot(), zAxis.getSlot());
+  VDW_Stepper::startCapture();
+  captureStart = millis();
+  xAxis.run(ConstantSpeed, 4000*1000);
+  zAxis.run(ConstantSpeed, 1237*1000);
+}
+
+void loop() {
+  if(!yAxis.isRunning()) yAxis.moveAbsolute((yAxis.currentPosition() > 0) ? -3000 : 3000, NoChange, 3000*1000);
+  if(millis() - captureStart > CAPTURE_MS) VDW_Stepper::stopCapture();
+  VDW_Stepper::dumpCapture(Serial);
+}
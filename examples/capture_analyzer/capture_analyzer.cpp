@@ -0,0 +1,236 @@
+/*
+ * Project VDW_Stepper
+ * Description: Host tool for step captures (STEP_CAPTURE). Reads the output of VDW_Stepper::dumpCapture(),
+ *   rebuilds the position and velocity of every motor and reports how far each step was from the schedule
+ *   the library commanded. Every record carries how late the step was against its due time, so the commanded
+ *   step times are the captured times less the lateness. Other lines in the log are skipped, so the capture
+ *   can share Serial with the rest of the firmware.
+ *
+ *   Build and run on a PC, nothing else from the library is needed:
+ *     g++ -std=c++11 -O2 examples/capture_analyzer/capture_analyzer.cpp -o capture_analyzer
+ *     ./capture_analyzer [--speed slot=steps/sec]... [--csv slot] < serial.log
+ *
+ *   --speed  compares the intervals of a motor with a constant speed instead of its schedule, ie to measure
+ *            the error of a fixed update rate library running the same profile
+ *   --csv    prints time (u-sec), position (steps) and velocity (steps/sec) of every step of a motor instead
+ *            of the report
+ * Author:
+ * Date:
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <map>
+#include <vector>
+
+#define MAX_SLOTS 64 // slots fit in 6 bits of a record
+
+// A decoded step
+struct Step{
+  uint64_t ticks; // CPU_Ticks() of the pass that stepped it, extended to 64 bits
+  bool direction; // true == CW
+  int8_t lateness; // u-sec late against its due time
+  uint32_t run; // absolute records written so far, steps of different runs have dropped steps between them
+};
+
+// Parsed log
+struct Capture{
+  uint32_t ticksPerMicrosecond = 120; // Photon, until a header says otherwise
+  std::vector<uint8_t> bytes; // records, in the order they were dumped
+  uint32_t dropped = 0; // steps the controller could not fit in its ring
+  std::vector<Step> steps[MAX_SLOTS];
+  uint32_t passes = 0; // Run_ISR() passes that stepped
+  uint32_t truncated = 0; // bytes of a record cut off at the end of the log
+};
+
+static int hexValue(char c){
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Read Log
+// Collects the record bytes and the header lines, anything else is skipped
+static void readLog(FILE *input, Capture &capture){
+  char line[512];
+  while(fgets(line, sizeof(line), input)){
+    unsigned long value;
+    if(sscanf(line, "#STEPCAP ticksPerMicrosecond %lu", &value) == 1){
+      if(value > 0) capture.ticksPerMicrosecond = value;
+    }else if(sscanf(line, "#STEPCAP dropped %lu", &value) == 1){
+      capture.dropped += value;
+    }else if(line[0] == 'C' && line[1] == ' '){
+      for(char *c = line + 2; hexValue(c[0]) >= 0 && hexValue(c[1]) >= 0; c += 2){
+        capture.bytes.push_back(hexValue(c[0]) << 4 | hexValue(c[1]));
+      }
+    }
+  }
+}
+
+// Decode
+// Splits the records into the steps of each slot. Absolute records hold the low 32 bits of the clock, they
+// are extended from the last time, so gaps between records must be under 2^32 ticks (35 sec at 120MHz).
+static void decode(Capture &capture){
+  const std::vector<uint8_t> &bytes = capture.bytes;
+  uint64_t ticks = 0;
+  bool first = true;
+  uint32_t run = 0;
+  size_t i = 0;
+  while(i < bytes.size()){
+    size_t start = i;
+    uint8_t header = bytes[i++];
+    uint64_t time;
+    if(header & 0x80){
+      if(i + 4 > bytes.size()) break;
+      uint32_t absolute = bytes[i] | (uint32_t)bytes[i+1] << 8 | (uint32_t)bytes[i+2] << 16 | (uint32_t)bytes[i+3] << 24;
+      i += 4;
+      run += 1;
+      time = (first) ? absolute : ticks + (uint32_t)(absolute - (uint32_t)ticks);
+    }else{
+      uint64_t delta = 0;
+      uint8_t shift = 0;
+      bool complete = false;
+      while(i < bytes.size() && shift < 35){
+        uint8_t value = bytes[i++];
+        delta |= (uint64_t)(value & 0x7F) << shift;
+        shift += 7;
+        if(!(value & 0x80)){ complete = true; break; }
+      }
+      if(!complete){ i = start; break; }
+      time = ticks + delta;
+    }
+    if(i >= bytes.size()){ i = start; break; }
+    Step step;
+    step.ticks = time;
+    step.direction = header & 0x40;
+    step.lateness = (int8_t)bytes[i++];
+    step.run = run;
+    if(first || time != ticks) capture.passes += 1;
+    capture.steps[header & 0x3F].push_back(step);
+    ticks = time;
+    first = false;
+  }
+  capture.truncated = bytes.size() - i;
+}
+
+// Statistics of a series
+struct Series{
+  uint32_t count = 0;
+  double sum = 0, sumSquares = 0, min = 0, max = 0;
+  void add(double value){
+    if(count == 0 || value < min) min = value;
+    if(count == 0 || value > max) max = value;
+    sum += value;
+    sumSquares += value * value;
+    count += 1;
+  }
+  double mean() const { return (count) ? sum / count : 0; }
+  double rms() const { return (count) ? sqrt(sumSquares / count) : 0; }
+};
+
+// Report
+// The timing of one motor. Intervals are compared with the commanded interval, the difference of the commanded
+// times of two steps, or with 1/speed if a speed was given. Intervals across a stop, a reversal or dropped
+// steps are left out.
+static void report(const Capture &capture, uint8_t slot, double speed){
+  const std::vector<Step> &steps = capture.steps[slot];
+  double tpu = capture.ticksPerMicrosecond;
+  int32_t position = 0;
+  uint32_t clamped = 0;
+  Series lateness, interval, intervalError;
+  double startTime = steps.front().ticks / tpu;
+  double endTime = steps.back().ticks / tpu;
+  for(size_t i=0; i<steps.size(); i++){
+    const Step &step = steps[i];
+    position += (step.direction) ? 1 : -1;
+    lateness.add(step.lateness);
+    if(step.lateness == 127 || step.lateness == -127) clamped += 1;
+    if(i == 0 || step.direction != steps[i-1].direction || step.run != steps[i-1].run) continue;
+
+    double actual = (step.ticks - steps[i-1].ticks) / tpu;
+    double commanded = (speed > 0) ? 1e6 / speed : actual - (step.lateness - steps[i-1].lateness);
+    if(commanded <= 0) continue;
+    if(speed <= 0 && commanded > 1e6) continue; // a start from rest, not a speed
+    interval.add(actual);
+    intervalError.add(100.0 * (actual - commanded) / commanded);
+  }
+
+  printf("slot %u\n", slot);
+  printf("  steps %zu, net position %+d, %.3f ms\n", steps.size(), position, (endTime - startTime) / 1000);
+  if(endTime > startTime) printf("  mean speed %.1f steps/sec\n", (steps.size() - 1) * 1e6 / (endTime - startTime));
+  printf("  lateness (us): mean %.2f, rms %.2f, min %.0f, max %.0f", lateness.mean(), lateness.rms(), lateness.min, lateness.max);
+  if(clamped) printf(", %u clamped at 127", clamped);
+  printf("\n");
+  if(intervalError.count == 0) return;
+  double worst = (fabs(intervalError.min) > fabs(intervalError.max)) ? intervalError.min : intervalError.max;
+  printf("  interval error vs %s (%%): mean %+.3f, rms %.3f, worst %+.3f over %u intervals\n",
+    (speed > 0) ? "speed" : "schedule", intervalError.mean(), intervalError.rms(), worst, intervalError.count);
+  if(speed > 0) printf("  commanded %.1f steps/sec, mean interval %.2f us\n", speed, interval.mean());
+}
+
+// CSV
+// Time, position and velocity (from the interval to the previous step) of every step of a motor
+static void csv(const Capture &capture, uint8_t slot){
+  const std::vector<Step> &steps = capture.steps[slot];
+  double tpu = capture.ticksPerMicrosecond;
+  int32_t position = 0;
+  printf("time_us,position,velocity\n");
+  for(size_t i=0; i<steps.size(); i++){
+    position += (steps[i].direction) ? 1 : -1;
+    double time = (steps[i].ticks - steps.front().ticks) / tpu;
+    double velocity = 0;
+    if(i > 0 && steps[i].direction == steps[i-1].direction && steps[i].run == steps[i-1].run){
+      velocity = 1e6 * tpu / (steps[i].ticks - steps[i-1].ticks);
+      if(!steps[i].direction) velocity = -velocity;
+    }
+    printf("%.3f,%d,%.2f\n", time, position, velocity);
+  }
+}
+
+int main(int argc, char **argv){
+  std::map<int, double> speeds;
+  int csvSlot = -1;
+  for(int i=1; i<argc; i++){
+    int slot;
+    double speed;
+    if(!strcmp(argv[i], "--speed") && i + 1 < argc && sscanf(argv[i+1], "%d=%lf", &slot, &speed) == 2){
+      speeds[slot] = speed;
+      i++;
+    }else if(!strcmp(argv[i], "--csv") && i + 1 < argc){
+      csvSlot = atoi(argv[++i]);
+    }else{
+      fprintf(stderr, "usage: %s [--speed slot=steps/sec]... [--csv slot] < serial.log\n", argv[0]);
+      return 2;
+    }
+  }
+
+  Capture capture;
+  readLog(stdin, capture);
+  decode(capture);
+
+  if(csvSlot >= 0){
+    if(csvSlot >= MAX_SLOTS || capture.steps[csvSlot].empty()){
+      fprintf(stderr, "no steps captured for slot %d\n", csvSlot);
+      return 1;
+    }
+    csv(capture, csvSlot);
+    return 0;
+  }
+
+  size_t total = 0;
+  for(uint8_t slot=0; slot<MAX_SLOTS; slot++) total += capture.steps[slot].size();
+  printf("%zu bytes, %zu steps in %u interrupt passes, %u dropped", capture.bytes.size(), total, capture.passes, capture.dropped);
+  if(capture.truncated) printf(", %u bytes of a cut off record", capture.truncated);
+  printf("\n");
+  if(total == 0) return 1;
+  if(capture.dropped) printf("steps were dropped, positions are short and intervals across a drop are left out\n");
+  for(uint8_t slot=0; slot<MAX_SLOTS; slot++){
+    if(capture.steps[slot].empty()) continue;
+    report(capture, slot, (speeds.count(slot)) ? speeds[slot] : 0);
+  }
+  return 0;
+}
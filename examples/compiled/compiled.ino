@@ -0,0 +1,47 @@
+/*
+ * Project VDW_Stepper
+ * Description: Compiled moves. Runs long moves back and forth on a step/direction driver with the step
+ *   intervals compiled in loop() and played back by Run_ISR(). Prints the time spent in Run_ISR() and
+ *   the number of times the compiler fell behind.
+ * Author:
+ * Date:
+ */
+
+#include "VDW_Stepper.h"
+
+#define STEP_PIN D0
+#define DIR_PIN D1
+#define ENABLE_PIN D2
+
+VDW_Stepper myStepper;
+CompiledBuffer compiledBuffer; // ~700 bytes, only steppers that compile their moves need one
+int32_t target = 200000;
+
+SYSTEM_MODE(MANUAL);
+
+void setup() {
+  Serial.begin(230400);
+  delay(5000);
+
+  myStepper.initPins(STEP_PIN, DIR_PIN, ENABLE_PIN);
+  myStepper.setCompiledBuffer(&compiledBuffer);
+  myStepper.setMode(Accelerations);
+  myStepper.setSpeed(40000*1000);
+  myStepper.setAcceleration(20000*1000);
+}
+
+void loop() {
+  // Keep the buffer topped up, one chunk lasts COMPILED_CHUNK_SIZE steps (3.2 ms at full speed)
+  VDW_Stepper::compileMoves();
+
+  if(!myStepper.isRunning()){
+    ISRStats stats;
+    VDW_Stepper::getISRStats(stats);
+    Serial.printlnf("At %ld: ISR mean %lu ticks, max %lu ticks, %lu underruns", (long)myStepper.currentPosition(),
+      (unsigned long)stats.meanTicks, (unsigned long)stats.maxTicks, (unsigned long)compiledBuffer.underruns);
+    VDW_Stepper::resetISRStats();
+
+    target = -target;
+    myStepper.moveAbsolute(target);
+  }
+}
@@ -0,0 +1,64 @@
+/*
+ * Project VDW_Stepper
+ * Description: Encoder reconciliation on the host simulator. A motor with a 4000 count encoder on a
+ *   3200 step/rev drive loses steps in the middle of a move, the lost steps are made up, then the motor
+ *   stalls for good and is stopped. Exits with 1 if the motor misses its target or the stall is missed.
+ *
+ *   Build and run from the library root:
+ *     g++ -std=c++11 -O2 -Isrc examples/encoder/encoder.cpp src/VDW_Stepper*.cpp -o encoder && ./encoder
+ * Author:
+ * Date:
+ */
+
+#include "VDW_Stepper.h"
+
+#define RECONCILE_MS 10 // reconcileEncoders() period
+#define FOLLOWING_WINDOW 2 // steps
+#define STALL_ERROR 400 // steps
+
+VDW_Stepper axis;
+SimMotor motor;
+
+int32_t readEncoder(){ return motor.encoder(); }
+
+// The loop() of the controller
+void runFor(uint32_t ms){
+  for(uint32_t i=0; i<ms; i+=RECONCILE_MS){
+    Simulator::runFor(RECONCILE_MS * 1000);
+    VDW_Stepper::reconcileEncoders();
+  }
+}
+
+int main(){
+  axis.initPins(0, 16);
+  motor.attach(0, 16);
+  motor.encoderCounts = 4000;
+  motor.encoderSteps = 3200;
+
+  axis.setMode(Accelerations);
+  axis.setAcceleration(20000*1000);
+  axis.setSpeed(5000*1000);
+  axis.setEncoder(readEncoder, 4000, 3200, FOLLOWING_WINDOW, STALL_ERROR, true);
+
+  // Lose 20ms of steps while cruising
+  axis.moveAbsolute(20000);
+  runFor(1500);
+  motor.stalled = true;
+  Simulator::runFor(20000);
+  motor.stalled = false;
+  runFor(5000);
+  bool pass = (motor.position == 20000 && axis.currentPosition() == 20000);
+  Serial.printlnf("Skipped: motor at %ld, target 20000, %ld steps corrected %s", (long)motor.position, (long)axis.encoderCorrection(), pass ? "" : "FAIL");
+
+  // Stall for good
+  axis.moveAbsolute(0);
+  runFor(1000);
+  motor.stalled = true;
+  runFor(500);
+  bool stalled = (axis.encoderState() == ENCODER_STALLED && !axis.isRunning() && axis.currentPosition() == motor.position);
+  if(!stalled) pass = false;
+  Serial.printlnf("Stalled: %s, stopped at %ld, motor at %ld %s", (axis.encoderState() == ENCODER_STALLED) ? "yes" : "no", (long)axis.currentPosition(), (long)motor.position, stalled ? "" : "FAIL");
+
+  Serial.printlnf(pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
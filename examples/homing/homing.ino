@@ -0,0 +1,40 @@
+/*
+ * Project VDW_Stepper
+ * Description: Homing. The axis runs toward a normally open limit switch on D6 at full speed, latches the
+ *   switch in its edge interrupt, backs off 200 steps and touches it again slowly. The switch becomes
+ *   position 0, then the axis moves to the middle of its travel.
+ * Author:
+ * Date:
+ */
+
+#include "VDW_Stepper.h"
+
+VDW_Stepper xAxis;
+bool homed = false;
+
+SYSTEM_MODE(MANUAL);
+
+void setup() {
+  Serial.begin(9600);
+
+  xAxis.initPins(D0, D1, D2);
+  xAxis.setMode(Accelerations);
+  xAxis.setAcceleration(20000*1000);
+
+  // Switch to ground, active low
+  pinMode(D6, INPUT_PULLUP);
+  if(!xAxis.home(D6, -4000*1000, 200*1000, 200, 0, false)) Serial.println("Limit switch already hit");
+}
+
+void loop() {
+  if(homed) return;
+  HomingState state = xAxis.homingState();
+  if(state == HOMING_DONE){
+    homed = true;
+    Serial.println("Homed");
+    xAxis.moveAbsolute(10000);
+  }else if(state == HOMING_FAILED){
+    homed = true;
+    Serial.println("Homing failed");
+  }
+}
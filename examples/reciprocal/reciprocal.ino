@@ -0,0 +1,83 @@
+/*
+ * Project VDW_Stepper
+ * Description: Reciprocal division benchmark. Times the speed to interval conversion and the CPU tick
+ *   to u-sec conversion with a divide instruction against reciprocalDivide() and Reciprocal::divide(),
+ *   in CPU cycles per conversion, and checks that every result matches.
+ * Author:
+ * Date:
+ */
+
+#include "VDW_Stepper.h"
+
+#define CONVERSIONS 1000
+
+uint32_t speeds[CONVERSIONS]; // mSteps/sec
+uint32_t ticks[CONVERSIONS];
+volatile uint32_t sink; // keeps the compiler from removing the conversions
+
+SYSTEM_MODE(MANUAL);
+
+// Random
+// xorshift, the same values on every run
+uint32_t random32(){
+  static uint32_t state = 2463534242;
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+void setup() {
+  Serial.begin(230400);
+  delay(5000);
+
+  for(uint16_t i=0; i<CONVERSIONS; i++){
+    speeds[i] = ULTIMATE_MIN_SPEED + random32() % (ULTIMATE_MAX_SPEED - ULTIMATE_MIN_SPEED);
+    ticks[i] = random32() >> (random32() % 24);
+  }
+  uint32_t ticksPerMicrosecond = CPU_TICKS_PER_MICROSECOND();
+  Reciprocal reciprocal;
+  reciprocal.set(ticksPerMicrosecond);
+
+  Serial.printlnf("\n****************\nReciprocal Benchmark\n****************\n");
+
+  // Check
+  uint32_t errors = 0;
+  for(uint16_t i=0; i<CONVERSIONS; i++){
+    uint32_t remainder;
+    if(reciprocalDivide(1000000000, speeds[i]) != 1000000000 / speeds[i]) errors++;
+    if(reciprocal.divide(ticks[i], remainder) != ticks[i] / ticksPerMicrosecond) errors++;
+    if(remainder != ticks[i] % ticksPerMicrosecond) errors++;
+  }
+  Serial.printlnf("Mismatches: %lu", errors);
+
+  // Speed to interval
+  noInterrupts();
+  uint32_t start = CPU_Ticks();
+  for(uint16_t i=0; i<CONVERSIONS; i++) sink = 1000000000 / speeds[i];
+  uint32_t divideTicks = CPU_Ticks() - start;
+  start = CPU_Ticks();
+  for(uint16_t i=0; i<CONVERSIONS; i++) sink = reciprocalDivide(1000000000, speeds[i]);
+  uint32_t reciprocalTicks = CPU_Ticks() - start;
+  interrupts();
+  Serial.printlnf("Speed to interval, divide:            %lu cycles", divideTicks / CONVERSIONS);
+  Serial.printlnf("Speed to interval, reciprocalDivide:  %lu cycles", reciprocalTicks / CONVERSIONS);
+
+  // Ticks to u-sec
+  noInterrupts();
+  start = CPU_Ticks();
+  for(uint16_t i=0; i<CONVERSIONS; i++) sink = ticks[i] / CPU_TICKS_PER_MICROSECOND();
+  divideTicks = CPU_Ticks() - start;
+  start = CPU_Ticks();
+  for(uint16_t i=0; i<CONVERSIONS; i++){
+    uint32_t remainder;
+    sink = reciprocal.divide(ticks[i], remainder);
+  }
+  reciprocalTicks = CPU_Ticks() - start;
+  interrupts();
+  Serial.printlnf("Ticks to u-sec, divide:               %lu cycles", divideTicks / CONVERSIONS);
+  Serial.printlnf("Ticks to u-sec, Reciprocal::divide:   %lu cycles", reciprocalTicks / CONVERSIONS);
+}
+
+void loop() {
+}
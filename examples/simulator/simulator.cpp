@@ -0,0 +1,818 @@
+/*
+ * Project VDW_Stepper
+ * Description: Host simulation. Runs the real scheduler on Linux against the virtual clock in
+ *   VDW_Stepper-HAL-Linux.h, far faster than real time, and checks it: ramps and S-curves against the
+ *   ideal profile, queued moves, commands and S-curves replanned while moving, speed changes blended
+ *   while moving, coordinated moves and stopping them, the timer split, slow steps chained across timer
+ *   periods, the stepper registry, homing, pin steppers with long pulses, S-curve tables shared between
+ *   steppers, compiled moves, the move stream's frames, CRC and credits, the feed override, and the step
+ *   timing of many motors at once. Each check prints a line, the program exits with 1 if any of them fails so it can
+ *   run in CI.
+ *
+ *   Build and run from the library root:
+ *     g++ -std=c++11 -O2 -Isrc examples/simulator/simulator.cpp src/VDW_Stepper*.cpp -o simulator && ./simulator
+ * Author:
+ * Date:
+ */
+
+#include "VDW_Stepper.h"
+#include "VDW_StepperGroup.h"
+#include "VDW_StepperStream.h"
+#include <chrono>
+
+#define SIM_STEPPERS 32 // motors of the timing check
+#define CHECK_AXES 6 // motors of the other checks, after the timing check's
+#define SIM_SECONDS 60
+#define STEPS_PER_SECOND 200 // speed of the first stepper, each stepper runs a little faster than the last
+#define ISR_COST_TICKS 60 // modelled cost of each CPU_Ticks() read in Run_ISR() (0.5 u-sec)
+#define LATENCY_TICKS 240 // interrupts fire up to 2 u-sec late
+#define MAX_ERROR_USEC 20 // largest step timing error allowed
+#define MAX_SPEED_ERROR 2.0 // largest speed error of a ramp against the ideal profile (%)
+#define MAX_DURATION_ERROR 2.0 // largest error of the duration of a ramped move (%)
+#define LIMIT_PIN 40 // limit switch of the homing check
+#define LIMIT_POSITION -1234 // where the homing check's switch is hit
+
+VDW_Stepper steppers[SIM_STEPPERS + CHECK_AXES];
+SimMotor motors[SIM_STEPPERS + CHECK_AXES];
+
+// Step callbacks are plain function pointers, one pair per motor
+template<uint8_t N> void stepCW(){ motors[N].step(1); }
+template<uint8_t N> void stepCCW(){ motors[N].step(-1); }
+template<uint8_t N> void initSteppers(){
+  initSteppers<N-1>();
+  steppers[N-1].init(stepCW<N-1>, stepCCW<N-1>);
+}
+template<> void initSteppers<0>(){}
+
+// Axis
+// A stepper of the other checks, at position 0 with no steps recorded
+static VDW_Stepper& axis(uint8_t index){
+  steppers[SIM_STEPPERS + index].setCurrentPosition(0);
+  motors[SIM_STEPPERS + index].position = 0;
+  motors[SIM_STEPPERS + index].stepTimes.clear();
+  return steppers[SIM_STEPPERS + index];
+}
+static SimMotor& axisMotor(uint8_t index){ return motors[SIM_STEPPERS + index]; }
+
+// Seconds from start to a step
+static double stepSeconds(const SimMotor &motor, size_t step, uint64_t start){
+  return (double)(motor.stepTimes[step] - start) / (Simulator::ticksPerMicrosecond * 1000000.0);
+}
+
+// Ramp State
+// Distance (steps) and speed (steps/sec) t seconds into a ramp from rest to speed: jerk-limited (7 segment,
+// see VDW_Stepper-SCurve.cpp) if jerk > 0, otherwise constant acceleration
+// \return[double] the duration of the whole ramp (sec)
+static double rampState(double t, double speed, double accel, double jerk, double &distance, double &velocity){
+  if(jerk <= 0){
+    double rampTime = speed / accel;
+    if(t > rampTime) t = rampTime;
+    distance = accel * t * t / 2;
+    velocity = accel * t;
+    return rampTime;
+  }
+  double jerkTime = (speed * jerk < accel * accel) ? sqrt(speed / jerk) : accel / jerk;
+  double rampTime = (speed * jerk < accel * accel) ? 2 * jerkTime : speed / accel + jerkTime;
+  double peak = jerk * jerkTime;
+  if(t > rampTime) t = rampTime;
+  if(t <= jerkTime){
+    distance = jerk * t * t * t / 6;
+    velocity = jerk * t * t / 2;
+  }else if(t <= rampTime - jerkTime){
+    double t1 = t - jerkTime;
+    double speed1 = peak * jerkTime / 2;
+    distance = peak * jerkTime * jerkTime / 6 + speed1 * t1 + peak * t1 * t1 / 2;
+    velocity = speed1 + peak * t1;
+  }else{
+    // The mirror image of the jerk up, from the end of the ramp
+    double left = rampTime - t;
+    distance = speed * rampTime / 2 - speed * left + jerk * left * left * left / 6;
+    velocity = speed - jerk * left * left / 2;
+  }
+  return rampTime;
+}
+
+// Profile Speed
+// Ideal speed (steps/sec) at a position of a move from rest to rest that peaks at speed
+static double profileSpeed(double position, double distance, double speed, double accel, double jerk){
+  double rampSteps, velocity;
+  double rampTime = rampState(1e9, speed, accel, jerk, rampSteps, velocity);
+  if(position > distance / 2) position = distance - position; // decelerations mirror the acceleration
+  if(position >= rampSteps) return speed;
+
+  // Time the ramp reaches position
+  double low = 0, high = rampTime;
+  for(uint8_t i=0; i<50; i++){
+    double mid = (low + high) / 2, steps;
+    rampState(mid, speed, accel, jerk, steps, velocity);
+    if(steps > position) high = mid;
+    else low = mid;
+  }
+  rampState(low, speed, accel, jerk, rampSteps, velocity);
+  return velocity;
+}
+
+// Profile Error
+// Largest difference (%) between the speed of a move from rest to rest, one step interval at a time, and
+// the ideal profile at the middle of the interval. The first and last steps are left out: Run_ISR() times
+// each step from the speed at its start, which is far from the average speed over the step near rest
+// \param[double&] duration - returns the time from start to the last step (sec)
+static double profileError(const SimMotor &motor, uint64_t start, double distance, double speed, double accel, double jerk, double &duration){
+  const double ends = 50; // steps left out at each end
+  double maxError = 0;
+  for(size_t step=1; step<motor.stepTimes.size(); step++){
+    double position = step + 0.5; // between the steps to step and step + 1
+    if(position < ends || position > distance - ends) continue;
+    double measured = Simulator::ticksPerMicrosecond * 1000000.0 / (motor.stepTimes[step] - motor.stepTimes[step - 1]);
+    double error = 100 * fabs(measured / profileSpeed(position, distance, speed, accel, jerk) - 1);
+    if(error > maxError) maxError = error;
+  }
+  duration = (motor.stepTimes.empty()) ? 0 : stepSeconds(motor, motor.stepTimes.size() - 1, start);
+  return maxError;
+}
+
+// Profile Duration
+// Ideal time of a move from rest to rest that peaks at speed (sec)
+static double profileDuration(double distance, double speed, double accel, double jerk){
+  double rampSteps, velocity;
+  double rampTime = rampState(1e9, speed, accel, jerk, rampSteps, velocity);
+  return 2 * rampTime + (distance - 2 * rampSteps) / speed;
+}
+
+// Ramp
+// Trapezoidal and triangular moves follow the ideal constant acceleration profile
+static bool checkRamp(){
+  VDW_Stepper &stepper = axis(0);
+  SimMotor &motor = axisMotor(0);
+  bool pass = true;
+  const int32_t distances[] = {20000, 1000};
+  for(uint8_t i=0; i<2; i++){
+    motor.position = 0;
+    motor.stepTimes.clear();
+    stepper.setCurrentPosition(0);
+    uint64_t start = Simulator::ticks;
+    stepper.moveAbsolute(distances[i], Accelerations, 5000*1000, 20000*1000);
+    Simulator::runFor(5000000);
+    double speed = fmin(5000.0, sqrt(20000.0 * distances[i])); // triangular moves peak halfway
+    double duration;
+    double error = profileError(motor, start, distances[i], speed, 20000, 0, duration);
+    double durationError = 100 * fabs(duration / profileDuration(distances[i], speed, 20000, 0) - 1);
+    bool ok = motor.position == distances[i] && stepper.currentPosition() == distances[i] && !stepper.isRunning();
+    ok = ok && error <= MAX_SPEED_ERROR && durationError <= MAX_DURATION_ERROR;
+    if(!ok) pass = false;
+    Serial.printlnf("Ramp %5ld steps: at %ld, speed within %.2f%% of the profile, duration within %.2f%% %s", (long)distances[i], (long)motor.position, error, durationError, ok ? "" : "FAIL");
+  }
+  return pass;
+}
+
+// S-Curve
+// A jerk-limited move follows the ideal 7 segment profile
+static bool checkSCurve(){
+  VDW_Stepper &stepper = axis(0);
+  SimMotor &motor = axisMotor(0);
+  stepper.setJerk(100000*1000);
+  uint64_t start = Simulator::ticks;
+  stepper.moveAbsolute(20000, SCurve, 5000*1000, 20000*1000);
+  Simulator::runFor(6000000);
+  stepper.setJerk(0);
+  double duration;
+  double error = profileError(motor, start, 20000, 5000, 20000, 100000, duration);
+  double durationError = 100 * fabs(duration / profileDuration(20000, 5000, 20000, 100000) - 1);
+  bool ok = motor.position == 20000 && !stepper.isRunning() && error <= MAX_SPEED_ERROR && durationError <= MAX_DURATION_ERROR;
+  Serial.printlnf("S-curve: at %ld, speed within %.2f%% of the profile, duration within %.2f%% %s", (long)motor.position, error, durationError, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Queue
+// Queued moves run back to back: the next move's first step is one of its intervals after the last step
+// of the move before
+static bool checkQueue(){
+  VDW_Stepper &stepper = axis(0);
+  SimMotor &motor = axisMotor(0);
+  stepper.queueMove(1000, ConstantSpeed, 2000*1000);
+  stepper.queueMove(-500, ConstantSpeed, 4000*1000);
+  stepper.queueMove(2000, Accelerations, 5000*1000, 20000*1000);
+  Simulator::runFor(3000000);
+
+  // Steps 1000 and 2500 end the first two moves
+  bool ok = motor.position == 2000 && stepper.currentPosition() == 2000 && stepper.queueAvailable() == MOVE_QUEUE_SIZE - 1 && motor.stepTimes.size() == 1000 + 1500 + 2500;
+  double gap1 = (ok) ? (motor.stepTimes[1000] - motor.stepTimes[999]) / (double)Simulator::ticksPerMicrosecond : 0;
+  double gap2 = (ok) ? (motor.stepTimes[2500] - motor.stepTimes[2499]) / (double)Simulator::ticksPerMicrosecond : 0;
+  ok = ok && fabs(gap1 - 250) <= 5 && fabs(gap2 - 10000) <= 5; // 1/4000 sec, sqrt(2/20000) sec
+  Serial.printlnf("Queue: at %ld, %.1f and %.1f usec between moves %s", (long)motor.position, gap1, gap2, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Commands
+// A moving motor commanded again faster than it steps keeps its step countdown and stays on time
+static bool checkCommands(){
+  VDW_Stepper &stepper = axis(0);
+  SimMotor &motor = axisMotor(0);
+  stepper.run(ConstantSpeed, 1000*1000);
+  Simulator::runFor(500);
+  for(uint16_t i=0; i<5000; i++){
+    stepper.run(ConstantSpeed, 1000*1000 + (i & 1)); // every 200 u-sec, 5 commands a step, a new speed each time
+    Simulator::runFor(200);
+  }
+  stepper.stop();
+  Simulator::runFor(1000);
+  double maxError = 0;
+  for(size_t step=1; step<motor.stepTimes.size(); step++){
+    double error = fabs((double)(motor.stepTimes[step] - motor.stepTimes[step - 1]) / Simulator::ticksPerMicrosecond - 1000);
+    if(error > maxError) maxError = error;
+  }
+  bool ok = abs(motor.position - 1000) <= 1 && maxError <= MAX_ERROR_USEC;
+  Serial.printlnf("Commands: %ld steps in a second of 5000 commands, intervals within %.1f usec %s", (long)motor.position, maxError, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Mailbox
+// S-curve moves replanned faster than the motor steps, each with a new plan, never step faster than the
+// cruise speed and end where the last one goes
+static bool checkMailbox(){
+  VDW_Stepper &stepper = axis(0);
+  SimMotor &motor = axisMotor(0);
+  stepper.setJerk(100000*1000);
+  stepper.moveAbsolute(3000, SCurve, 5000*1000, 20000*1000);
+  Simulator::runFor(200000);
+  for(uint16_t i=0; i<2000; i++){
+    stepper.moveAbsolute((i & 1) ? 3000 + i : -1000 - i, SCurve, 5000*1000, 20000*1000); // 4 commands a step at speed
+    Simulator::runFor(50);
+  }
+  stepper.moveAbsolute(8000, SCurve, 5000*1000, 20000*1000);
+  Simulator::runFor(6000000);
+  stepper.setJerk(0);
+  double minInterval = 1e9;
+  for(size_t step=1; step<motor.stepTimes.size(); step++){
+    double interval = (double)(motor.stepTimes[step] - motor.stepTimes[step - 1]) / Simulator::ticksPerMicrosecond;
+    if(interval < minInterval) minInterval = interval;
+  }
+  bool ok = motor.position == 8000 && stepper.currentPosition() == 8000 && !stepper.isRunning() && minInterval >= 200 - MAX_ERROR_USEC;
+  Serial.printlnf("Mailbox: at %ld after 2000 commands, %lu steps, fastest step %.1f usec %s", (long)motor.position, (unsigned long)motor.stepTimes.size(), minInterval, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Blend
+// A running motor given a new speed blends to it from its next step in both modes: no step interval
+// outside the old and new intervals, and no interval changes by more than the acceleration allows
+static bool checkBlend(){
+  const Mode modes[] = {ConstantSpeed, Accelerations};
+  bool ok = true;
+  for(uint8_t m=0; m<2; m++){
+    VDW_Stepper &stepper = axis(0);
+    SimMotor &motor = axisMotor(0);
+    stepper.run(modes[m], 2000*1000, 20000*1000);
+    Simulator::runFor(500000);
+    size_t first = motor.stepTimes.size(); // at 2000 steps/sec
+    stepper.run(modes[m], 4000*1000, 20000*1000);
+    Simulator::runFor(500000);
+    stepper.run(modes[m], 1000*1000, 20000*1000);
+    Simulator::runFor(500000);
+    stepper.stop();
+    size_t last = motor.stepTimes.size(); // at 1000 steps/sec
+    Simulator::runFor(200000);
+
+    double minInterval = 1e9, maxInterval = 0, maxJump = 0, previous = 0;
+    for(size_t step=first; step<last; step++){
+      double interval = (double)(motor.stepTimes[step] - motor.stepTimes[step - 1]) / Simulator::ticksPerMicrosecond;
+      if(interval < minInterval) minInterval = interval;
+      if(interval > maxInterval) maxInterval = interval;
+      double ramp = 20000 * pow(fmax(interval, previous) / 1000000, 3) * 1000000; // change in 1/speed in a step at 20000 steps/sec^2
+      if(previous > 0 && fabs(interval - previous) - ramp > maxJump) maxJump = fabs(interval - previous) - ramp;
+      previous = interval;
+    }
+    bool modeOk = minInterval >= 250 - MAX_ERROR_USEC && maxInterval <= 1000 + MAX_ERROR_USEC && maxJump <= MAX_ERROR_USEC;
+    Serial.printlnf("Blend (%s): intervals %.1f to %.1f usec, changes within %.1f usec of the ramp %s",
+      (modes[m] == ConstantSpeed) ? "Constant Speed" : "Accelerations", minInterval, maxInterval, maxJump, modeOk ? "" : "FAIL");
+    ok = ok && modeOk;
+  }
+  return ok;
+}
+
+// Group
+// Minor axes stay within a step of the line through the whole move and all axes arrive together
+static bool checkGroup(){
+  StepperGroup group;
+  for(uint8_t i=0; i<3; i++) group.add(axis(i));
+  int32_t targets[] = {3000, 1000, -2000};
+  bool ok = group.moveAbsolute(targets, Accelerations, 4000*1000, 20000*1000);
+  Simulator::runFor(3000000);
+
+  const SimMotor &dominant = axisMotor(0);
+  double maxError = 0;
+  for(uint8_t i=1; i<3; i++){
+    const SimMotor &minor = axisMotor(i);
+    size_t minorStep = 0;
+    for(size_t step=0; step<dominant.stepTimes.size(); step++){
+      while(minorStep < minor.stepTimes.size() && minor.stepTimes[minorStep] <= dominant.stepTimes[step]) minorStep++;
+      double error = fabs(minorStep - (step + 1) * (double)abs(targets[i]) / targets[0]);
+      if(error > maxError) maxError = error;
+    }
+  }
+  for(uint8_t i=0; i<3; i++){
+    if(axisMotor(i).position != targets[i] || steppers[SIM_STEPPERS + i].currentPosition() != targets[i]) ok = false;
+  }
+  ok = ok && maxError <= 1 && !group.isRunning();
+  ok = ok && axisMotor(1).stepTimes.back() <= dominant.stepTimes.back() && axisMotor(2).stepTimes.back() <= dominant.stepTimes.back();
+  Serial.printlnf("Group: at %ld, %ld, %ld, minor axes %.2f steps from the line %s", (long)axisMotor(0).position, (long)axisMotor(1).position, (long)axisMotor(2).position, maxError, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Group Stop
+// Every way of stopping the dominant axis ends the move and leaves the minor axes where they are, minor
+// axes run until then
+static bool checkGroupStop(){
+  StepperGroup group;
+  for(uint8_t i=0; i<3; i++) group.add(axis(i));
+  int32_t targets[] = {3000, 1000, -2000};
+  bool ok = true;
+  const char *ways[] = {"stop()", "group eStop()", "eStop()", "disable()", "decelerating stop()"};
+  for(uint8_t way=0; way<5; way++){
+    int32_t start[3];
+    int32_t moveTargets[3];
+    for(uint8_t i=0; i<3; i++){
+      start[i] = steppers[SIM_STEPPERS + i].currentPosition();
+      moveTargets[i] = start[i] + targets[i];
+    }
+    bool wayOk = group.moveAbsolute(moveTargets, (way == 4) ? Accelerations : ConstantSpeed, 4000*1000, 20000*1000);
+    Simulator::runFor(100000);
+    wayOk = wayOk && group.isRunning() && steppers[SIM_STEPPERS + 1].isRunning() && steppers[SIM_STEPPERS + 2].isRunning();
+    VDW_Stepper &dominant = steppers[SIM_STEPPERS];
+    if(way == 0 || way == 4) group.stop();
+    else if(way == 1) group.eStop();
+    else if(way == 2) dominant.eStop();
+    else dominant.disable();
+    if(way == 4) Simulator::runFor(1000000); // decelerates
+    else wayOk = wayOk && !group.isRunning();
+    Simulator::runFor(10000);
+    int32_t stopped[3];
+    for(uint8_t i=0; i<3; i++) stopped[i] = axisMotor(i).position;
+    Simulator::runFor(100000);
+    for(uint8_t i=0; i<3; i++){
+      if(steppers[SIM_STEPPERS + i].isRunning() || axisMotor(i).position != stopped[i]) wayOk = false;
+      if(way != 1 && steppers[SIM_STEPPERS + i].targetPosition() != steppers[SIM_STEPPERS + i].currentPosition()) wayOk = false;
+    }
+    wayOk = wayOk && !group.isRunning() && stopped[0] != start[0] && stopped[0] - start[0] != targets[0];
+    if(!wayOk) Serial.printlnf("Group stop: %s left the move running FAIL", ways[way]);
+    ok = ok && wayOk;
+    if(way == 3) dominant.enable();
+  }
+  if(ok) Serial.printlnf("Group stop: stop(), eStop(), disable() and a decelerating stop() end the move");
+  return ok;
+}
+
+// Timers
+// Steppers fill the first timer up to STEP_TIMER_MAX_RATE and spill onto the next, a hint overrides that,
+// and every timer keeps its steppers on time
+static bool checkTimers(){
+  const uint32_t speed = STEP_TIMER_MAX_RATE / 2000; // steps/sec, two fill a timer
+  for(uint8_t i=0; i<4; i++) axis(i);
+  steppers[SIM_STEPPERS + 3].setTimer(STEP_TIMERS - 1);
+  for(uint8_t i=0; i<4; i++) steppers[SIM_STEPPERS + i].run(ConstantSpeed, speed * 1000);
+  uint8_t expected[] = {0, 0, 1, STEP_TIMERS - 1};
+  bool ok = true;
+  for(uint8_t i=0; i<4; i++){
+    if(steppers[SIM_STEPPERS + i].getTimer() != expected[i]) ok = false;
+  }
+  Simulator::runFor(1000000);
+  for(uint8_t i=0; i<4; i++){
+    steppers[SIM_STEPPERS + i].stop();
+    if(abs(axisMotor(i).position - (int32_t)speed) > 1) ok = false;
+  }
+  steppers[SIM_STEPPERS + 3].setTimer(-1);
+  Simulator::runFor(1000);
+  Serial.printlnf("Timers: %d, %d, %d and %d (hint), %ld steps in a second of %lu %s",
+    steppers[SIM_STEPPERS].getTimer(), steppers[SIM_STEPPERS + 1].getTimer(), steppers[SIM_STEPPERS + 2].getTimer(),
+    steppers[SIM_STEPPERS + 3].getTimer(), (long)axisMotor(2).position, (unsigned long)speed, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Slow Steps
+// Intervals longer than MAX_TIMER_PERIOD are chained from timer periods and stay exact to the u-sec
+static bool checkSlowSteps(){
+  VDW_Stepper &stepper = axis(0);
+  SimMotor &motor = axisMotor(0);
+  uint32_t interrupts = Simulator::interruptCount;
+  stepper.run(ConstantSpeed, 300); // 3.33 sec a step
+  Simulator::runFor(21000000);
+  stepper.stop();
+  interrupts = Simulator::interruptCount - interrupts;
+  double maxError = 0;
+  for(size_t step=1; step<motor.stepTimes.size(); step++){
+    double ideal = motor.stepTimes[0] + step * 10000000.0 / 3 * Simulator::ticksPerMicrosecond;
+    double error = fabs(motor.stepTimes[step] - ideal) / Simulator::ticksPerMicrosecond;
+    if(error > maxError) maxError = error;
+  }
+  uint32_t periods = 21000000 / MAX_TIMER_PERIOD;
+  bool ok = motor.position == 6 && maxError <= 3 && interrupts >= periods && interrupts <= periods + 20;
+  Serial.printlnf("Slow steps: %ld steps, max error %.1f usec, %lu interrupts %s", (long)motor.position, maxError, (unsigned long)interrupts, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Registry
+// Steppers take the free slots until the registry is full, a detached stepper stops at once and its slot
+// goes to the next stepper
+static bool checkRegistry(){
+  uint8_t free = MAX_STEPPER_SLOTS - SIM_STEPPERS - CHECK_AXES;
+  VDW_Stepper extra[MAX_STEPPER_SLOTS];
+  uint8_t attached = 0;
+  for(uint8_t i=0; i<MAX_STEPPER_SLOTS; i++){
+    if(extra[i].getSlot() != NO_SLOT) attached++;
+  }
+  bool ok = (attached == free && !extra[MAX_STEPPER_SLOTS - 1].attach());
+
+  // Detach a running stepper
+  VDW_Stepper &stepper = axis(0);
+  SimMotor &motor = axisMotor(0);
+  uint8_t slot = stepper.getSlot();
+  stepper.run(ConstantSpeed, 1000*1000);
+  Simulator::runFor(100500);
+  stepper.detach();
+  int32_t stopped = motor.position;
+  Simulator::runFor(100500);
+  ok = ok && stopped == 100 && motor.position == stopped && !stepper.isRunning() && stepper.getSlot() == NO_SLOT;
+
+  // Its slot is free until it is attached again, it can not run meanwhile
+  stepper.run(ConstantSpeed, 1000*1000);
+  Simulator::runFor(100500);
+  ok = ok && motor.position == stopped && !stepper.isRunning();
+  {
+    VDW_Stepper late;
+    ok = ok && late.getSlot() == slot;
+  }
+  ok = ok && stepper.attach() && stepper.getSlot() == slot;
+  stepper.run(ConstantSpeed, 1000*1000);
+  Simulator::runFor(100500);
+  stepper.stop();
+  ok = ok && motor.position == stopped + 100;
+  Serial.printlnf("Registry: %d slots free, detached at %ld, %ld after attaching again %s", free, (long)stopped, (long)motor.position, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Homing
+// The switch interrupt latches the step it is hit on, with and without a second touch, Run_ISR() stops the
+// motor and homingState() polled from the loop backs off and sets the position so the switch is at 0. The
+// motor stops at the switch even if homingState() is not polled until long after
+static bool checkHoming(){
+  bool ok = true;
+  const uint32_t touchSpeeds[] = {0, 200*1000, 0};
+  const uint32_t pollUsec[] = {1000, 1000, 2000000}; // a 1 msec loop(), or one busy for 2 sec
+  for(uint8_t t=0; t<3; t++){
+    VDW_Stepper &stepper = axis(3);
+    SimMotor &motor = axisMotor(3);
+    motor.attachLimit(LIMIT_PIN, LIMIT_POSITION);
+    stepper.setMode(Accelerations);
+    stepper.setAcceleration(20000*1000);
+    bool touchOk = stepper.home(LIMIT_PIN, -4000*1000, touchSpeeds[t], 200, 0, true);
+    HomingState state = HOMING_SEEKING;
+    int32_t lowest = 0;
+    uint32_t polls = 0;
+    while(touchOk && (state == HOMING_SEEKING || state == HOMING_TOUCHING) && polls++ < 10000){
+      Simulator::runFor(pollUsec[t]);
+      state = stepper.homingState();
+      if(motor.position < lowest) lowest = motor.position;
+    }
+    stepper.setMode(ConstantSpeed);
+    stepper.setAcceleration(0);
+
+    // The switch is at 0, both overshoots are past it and the last touch stops within a loop() of it
+    int32_t offset = stepper.currentPosition() - motor.position;
+    int32_t overshoot = LIMIT_POSITION - motor.position;
+    touchOk = touchOk && state == HOMING_DONE && !stepper.isRunning() && LIMIT_POSITION + offset == 0 && lowest < LIMIT_POSITION;
+    if(touchSpeeds[t] > 0) touchOk = touchOk && overshoot >= 0 && overshoot <= 1;
+    else touchOk = touchOk && overshoot >= 395 && overshoot <= 410; // decelerates from 4000 steps/sec over 400 steps
+    Serial.printlnf("Homing %s%s: switch at %ld, stopped %ld steps past it %s", (touchSpeeds[t] > 0) ? "with a second touch" : "in one touch",
+      (pollUsec[t] > 1000) ? " polled late" : "", (long)(LIMIT_POSITION + offset), (long)overshoot, touchOk ? "" : "FAIL");
+    ok = ok && touchOk;
+  }
+
+  // Detaching part way releases the switch interrupt, it would call into a destroyed stepper
+  VDW_Stepper &stepper = axis(3);
+  axisMotor(3).attachLimit(LIMIT_PIN, LIMIT_POSITION);
+  bool detachOk = stepper.home(LIMIT_PIN, -1000*1000);
+  Simulator::runFor(100000);
+  stepper.detach();
+  detachOk = detachOk && Simulator::pinInterrupts.empty() && stepper.homingState() == HOMING_FAILED && stepper.attach();
+  Serial.printlnf("Homing detached while seeking: switch interrupt %s %s", (Simulator::pinInterrupts.empty()) ? "released" : "still attached", detachOk ? "" : "FAIL");
+  return ok && detachOk;
+}
+
+// Pin Steps
+// Pin steppers with pulses long enough for the falling edges of several passes to be waiting at once: steps
+// wait for room for their edge rather than the interrupt waiting for the pulses to end, and reversals write
+// the direction pins after the edges still waiting. Turns the axes into pin steppers, so it runs after the
+// other checks that use them
+static bool checkPinSteps(){
+  VDW_Stepper::setStepTiming(100, STEP_DIR_SETUP, STEP_DIR_HOLD);
+  for(uint8_t i=0; i<CHECK_AXES; i++){
+    axis(i).initPins(i, 16 + i);
+    axisMotor(i).attach(i, 16 + i);
+    steppers[SIM_STEPPERS + i].run(ConstantSpeed, (3000 + 100 * i) * 1000);
+  }
+  Simulator::runFor(1000000);
+  bool ok = true;
+  double maxError = 0;
+  int32_t positions[CHECK_AXES];
+  for(uint8_t i=0; i<CHECK_AXES; i++){
+    VDW_Stepper &stepper = steppers[SIM_STEPPERS + i];
+    const SimMotor &motor = axisMotor(i);
+    positions[i] = motor.position;
+    if(abs(motor.position - (3000 + 100 * i)) > 1 || motor.position != stepper.currentPosition()) ok = false;
+    for(size_t step=1; step<motor.stepTimes.size(); step++){
+      double ideal = motor.stepTimes[0] + step * 1000000.0 / (3000 + 100 * i) * Simulator::ticksPerMicrosecond;
+      double error = fabs(motor.stepTimes[step] - ideal) / Simulator::ticksPerMicrosecond;
+      if(error > maxError) maxError = error;
+    }
+  }
+
+  // Reverse them every 3.1 msec, the motors count the steps by their direction pins
+  uint16_t reversals = 0;
+  for(uint16_t r=0; r<200; r++){
+    for(uint8_t i=0; i<CHECK_AXES; i++) steppers[SIM_STEPPERS + i].run(ConstantSpeed, ((r & 1) ? 1 : -1) * (3000 + 100 * i) * 1000);
+    Simulator::runFor(3100);
+    reversals++;
+  }
+  for(uint8_t i=0; i<CHECK_AXES; i++) steppers[SIM_STEPPERS + i].stop();
+  Simulator::runFor(1000);
+  for(uint8_t i=0; i<CHECK_AXES; i++){
+    if(axisMotor(i).position != steppers[SIM_STEPPERS + i].currentPosition() || abs(axisMotor(i).position - positions[i]) > 20) ok = false;
+  }
+  VDW_Stepper::setStepTiming(STEP_PULSE_WIDTH, STEP_DIR_SETUP, STEP_DIR_HOLD);
+  ok = ok && maxError <= MAX_ERROR_USEC + 100;
+  Serial.printlnf("Pin steps: %d motors with 100 usec pulses, max error %.1f usec, at %ld to %ld after %u reversals %s", CHECK_AXES,
+    maxError, (long)axisMotor(0).position, (long)axisMotor(CHECK_AXES - 1).position, reversals, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Shared S-Curves
+// Steppers with the same profile share an S-curve table. Once every table holds a profile in use, moves
+// with a new profile run as trapezoids and still arrive. The first step tells them apart: about 39 msec
+// into an S-curve, 10 msec into a trapezoid
+static bool checkSharedSCurves(){
+  const uint8_t count = SCURVE_TABLES + 2; // steppers of the timing check, idle until it runs
+  uint8_t sCurves[2] = {0, 0};
+  bool ok = true;
+  for(uint8_t pass=0; pass<2; pass++){
+    uint64_t start = Simulator::ticks;
+    for(uint8_t i=0; i<count; i++){
+      steppers[i].setJerk(100000*1000);
+      // First the profile the S-curve checks left in a table, then a new profile each
+      uint32_t speed = (pass == 0) ? 5000 : 1000 + i * 300;
+      steppers[i].moveAbsolute((pass == 0) ? 20000 : 24000, SCurve, speed*1000, 20000*1000);
+    }
+    Simulator::runFor(8000000);
+    for(uint8_t i=0; i<count; i++){
+      ok = ok && motors[i].position == ((pass == 0) ? 20000 : 24000) && !steppers[i].isRunning();
+      if(!motors[i].stepTimes.empty() && stepSeconds(motors[i], 0, start) > 0.02) sCurves[pass]++;
+      motors[i].stepTimes.clear();
+    }
+  }
+  for(uint8_t i=0; i<count; i++){
+    steppers[i].setJerk(0);
+    steppers[i].setCurrentPosition(0);
+    motors[i].position = 0;
+  }
+  ok = ok && sCurves[0] == count && sCurves[1] == SCURVE_TABLES - 1;
+  Serial.printlnf("Shared S-curves: %d of %d steppers with one profile, %d of %d with their own %s", sCurves[0], count, sCurves[1], count, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Compiled
+// A compiled move steps at the same times as the same move run live, with no underruns while loop() keeps
+// the buffer topped up. Starved of compileMoves() it runs out, finishes with the live ramp math and still
+// arrives on time
+static bool checkCompiled(){
+  static CompiledBuffer buffer;
+  bool ok = true;
+  std::vector<uint64_t> live;
+  for(uint8_t run=0; run<3; run++){
+    VDW_Stepper &stepper = axis(1);
+    SimMotor &motor = axisMotor(1);
+    stepper.setCompiledBuffer((run == 0) ? nullptr : &buffer);
+    buffer.underruns = 0;
+    stepper.moveAbsolute(20000, Accelerations, 5000*1000, 20000*1000);
+    for(uint16_t ms=0; ms<6000; ms++){
+      if(run == 1) VDW_Stepper::compileMoves(); // a 1 msec loop()
+      Simulator::runFor(1000);
+    }
+    stepper.setCompiledBuffer(nullptr);
+    if(run == 0){
+      live = motor.stepTimes;
+      ok = ok && motor.position == 20000;
+      continue;
+    }
+
+    double maxError = 0;
+    for(size_t step=1; step<motor.stepTimes.size() && step<live.size(); step++){
+      double error = fabs((double)(motor.stepTimes[step] - motor.stepTimes[0]) - (double)(live[step] - live[0])) / Simulator::ticksPerMicrosecond;
+      if(error > maxError) maxError = error;
+    }
+    bool underran = (buffer.underruns > 0);
+    bool runOk = motor.position == 20000 && stepper.currentPosition() == 20000 && !stepper.isRunning() &&
+      motor.stepTimes.size() == live.size() && maxError <= MAX_ERROR_USEC && underran == (run == 2);
+    if(!runOk) ok = false;
+    Serial.printlnf("Compiled %s: at %ld, within %.1f usec of the live move, %lu underruns %s", (run == 1) ? "with loop()" : "starved",
+      (long)motor.position, maxError, (unsigned long)buffer.underruns, runOk ? "" : "FAIL");
+  }
+  return ok;
+}
+
+// Stream Host
+// The host end of a StepperStream link: sends frames and reads the replies, checking their CRC
+struct StreamHost{
+  SimStream link;
+  size_t replyRead = 0; // bytes of link.output already read
+  uint8_t credits[2] = {0, 0};
+  uint32_t syncs = 0;
+  uint32_t badReplies = 0;
+  uint32_t errors[STREAM_ERROR_FULL + 1] = {0};
+
+  void send(StreamCommand command, uint8_t stepper, int32_t target=0, bool corrupt=false){
+    uint8_t frame[STREAM_FRAME_SIZE];
+    StepperStream::encodeFrame(frame, command, stepper, target, Accelerations, 5000*1000, 20000*1000);
+    if(corrupt) frame[5] ^= 0x10;
+    link.input.insert(link.input.end(), frame, frame + STREAM_FRAME_SIZE);
+  }
+
+  void readReplies(){
+    for(; replyRead + STREAM_REPLY_SIZE <= link.output.size(); replyRead += STREAM_REPLY_SIZE){
+      const uint8_t *reply = &link.output[replyRead];
+      if(reply[0] != STREAM_START || StepperStream::crc8(reply, STREAM_REPLY_SIZE - 1) != reply[7]){
+        badReplies++;
+        continue;
+      }
+      int32_t value = reply[3] | (reply[4] << 8) | (reply[5] << 16) | (reply[6] << 24);
+      if(reply[1] == STREAM_REPLY_SYNC) syncs++;
+      else if(reply[1] == STREAM_REPLY_CREDIT && reply[2] < 2) credits[reply[2]] += value;
+      else if(reply[1] == STREAM_REPLY_ERROR && value > 0 && value <= STREAM_ERROR_FULL) errors[value]++;
+    }
+  }
+};
+
+// Stream
+// A host streams moves to two steppers, a move per credit, from a 1 msec loop(). A frame with a bad CRC is
+// reported and dropped, the host sends it again and every move still runs in order. A move sent without a
+// credit is refused once the queue is full, and a stop clears the queue
+static int32_t streamTarget(uint8_t stepper, uint8_t move){ return ((move & 1) ? -1 : 1) * (200 + 50 * move + 100 * stepper); }
+static bool checkStream(){
+  StreamHost host;
+  StepperStream moveStream;
+  VDW_Stepper *axes[2] = {&axis(1), &axis(2)};
+  moveStream.add(*axes[0]);
+  moveStream.add(*axes[1]);
+  moveStream.begin(host.link);
+
+  // The first stepper's fifth move is corrupted once. The controller still counts its credit as held, so
+  // the host sends it again without one when the error comes back
+  const uint8_t moves = 20;
+  const uint8_t corruptMove = 5;
+  uint8_t sent[2] = {0, 0};
+  bool resent = false;
+  host.send(STREAM_SYNC, 0);
+  for(uint16_t ms=0; ms<30000 && (sent[0] < moves || sent[1] < moves || axes[0]->isRunning() || axes[1]->isRunning()); ms++){
+    moveStream.update();
+    host.readReplies();
+    if(!resent && host.errors[STREAM_ERROR_CHECKSUM] > 0){
+      host.send(STREAM_MOVE, 0, streamTarget(0, corruptMove));
+      resent = true;
+    }
+    for(uint8_t i=0; i<2; i++){
+      while(host.syncs > 0 && host.credits[i] > 0 && sent[i] < moves && !(i == 0 && sent[i] > corruptMove && !resent)){
+        host.send(STREAM_MOVE, i, streamTarget(i, sent[i]), i == 0 && sent[i] == corruptMove);
+        host.credits[i]--;
+        sent[i]++;
+      }
+    }
+    Simulator::runFor(1000);
+  }
+  host.readReplies();
+  bool ok = host.syncs == 1 && host.badReplies == 0 && host.errors[STREAM_ERROR_CHECKSUM] == 1 && host.errors[STREAM_ERROR_FULL] == 0;
+  for(uint8_t i=0; i<2; i++){
+    int32_t position = 0;
+    size_t steps = 0;
+    for(uint8_t m=0; m<moves; m++){
+      steps += abs(streamTarget(i, m) - position);
+      position = streamTarget(i, m);
+    }
+    ok = ok && axisMotor(1 + i).position == position && axisMotor(1 + i).stepTimes.size() == steps;
+  }
+  ok = ok && moveStream.framesDecoded() == 1 + 2 * moves && moveStream.checksumErrors() == 1;
+  Serial.printlnf("Stream: %lu frames, %lu CRC errors, at %ld and %ld after %d moves each %s", (unsigned long)moveStream.framesDecoded(),
+    (unsigned long)moveStream.checksumErrors(), (long)axisMotor(1).position, (long)axisMotor(2).position, moves, ok ? "" : "FAIL");
+
+  // More moves than the credits, all in one go: one runs, the queue holds MOVE_QUEUE_SIZE - 1, two are refused
+  host.send(STREAM_SYNC, 0);
+  moveStream.update();
+  host.readReplies();
+  for(uint8_t m=0; m<MOVE_QUEUE_SIZE + 2; m++) host.send(STREAM_MOVE, 0, 100000 * ((m & 1) ? -1 : 1));
+  moveStream.update();
+  host.readReplies();
+  bool refused = host.errors[STREAM_ERROR_FULL] == 2 && axes[0]->queueAvailable() == 0;
+  host.send(STREAM_STOP, 0);
+  moveStream.update();
+  Simulator::runFor(2000000);
+  moveStream.update();
+  host.readReplies();
+  bool stopped = !axes[0]->isRunning() && axes[0]->queueAvailable() == MOVE_QUEUE_SIZE - 1 && host.badReplies == 0;
+  Serial.printlnf("Stream without credits: %lu moves refused, %s after the stop %s", (unsigned long)host.errors[STREAM_ERROR_FULL],
+    stopped ? "idle" : "running", (refused && stopped) ? "" : "FAIL");
+  return ok && refused && stopped;
+}
+
+// Feed Override
+// The override scales a running motor's speed from its next step: 1000 steps/sec runs at 500 and 2000
+// steps/sec at 50% and 200%. A ramped move at 200% follows the profile at twice the speed and four times the
+// acceleration, and arrives
+static bool checkFeedOverride(){
+  VDW_Stepper &stepper = axis(1);
+  SimMotor &motor = axisMotor(1);
+  const uint16_t overrides[] = {100, 50, 200};
+  double maxError = 0;
+  stepper.run(ConstantSpeed, 1000*1000);
+  for(uint8_t i=0; i<3; i++){
+    VDW_Stepper::setFeedOverride(overrides[i]);
+    size_t first = motor.stepTimes.size() + 1; // the step already scheduled keeps the old interval
+    Simulator::runFor(1000000);
+    for(size_t step=first + 1; step<motor.stepTimes.size(); step++){
+      double interval = (double)(motor.stepTimes[step] - motor.stepTimes[step - 1]) / Simulator::ticksPerMicrosecond;
+      double error = fabs(interval - 1000.0 * 100 / overrides[i]);
+      if(error > maxError) maxError = error;
+    }
+  }
+  stepper.stop();
+  Simulator::runFor(10000);
+  bool ok = abs(motor.position - 3500) <= 2 && maxError <= MAX_ERROR_USEC;
+
+  // A ramped move
+  axis(1);
+  VDW_Stepper::setFeedOverride(200);
+  uint64_t start = Simulator::ticks;
+  stepper.moveAbsolute(20000, Accelerations, 2500*1000, 5000*1000); // the ramp check's move at 200%
+  Simulator::runFor(5000000);
+  VDW_Stepper::setFeedOverride(100);
+  double duration;
+  double error = profileError(motor, start, 20000, 5000, 20000, 0, duration);
+  double durationError = 100 * fabs(duration / profileDuration(20000, 5000, 20000, 0) - 1);
+  ok = ok && motor.position == 20000 && stepper.currentPosition() == 20000 && !stepper.isRunning();
+  ok = ok && error <= MAX_SPEED_ERROR && durationError <= MAX_DURATION_ERROR;
+  Serial.printlnf("Feed override: intervals within %.1f usec, ramp at 200%% within %.2f%% of the profile, duration within %.2f%% %s",
+    maxError, error, durationError, ok ? "" : "FAIL");
+  return ok;
+}
+
+// Timing
+// Every step of many Constant Speed motors should land within MAX_ERROR_USEC of the ideal schedule set by
+// the first step
+static bool checkTiming(){
+  VDW_Stepper::resetISRStats();
+  for(uint8_t i=0; i<SIM_STEPPERS; i++){
+    steppers[i].run(ConstantSpeed, (STEPS_PER_SECOND + i * 37) * 1000);
+  }
+
+  uint32_t interrupts = Simulator::interruptCount;
+  std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+  Simulator::runFor(SIM_SECONDS * 1000000ULL);
+  double wallTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  for(uint8_t i=0; i<SIM_STEPPERS; i++) steppers[i].stop();
+
+  bool pass = true;
+  uint64_t totalSteps = 0;
+  for(uint8_t i=0; i<SIM_STEPPERS; i++){
+    SimMotor &motor = motors[i];
+    uint32_t speed = STEPS_PER_SECOND + i * 37;
+    double interval = 1000000.0 / speed; // u-sec, exact, Run_ISR() carries the fraction
+    double maxError = 0;
+    for(size_t step=0; step<motor.stepTimes.size(); step++){
+      double ideal = motor.stepTimes[0] + (double)step * interval * Simulator::ticksPerMicrosecond;
+      double error = fabs(motor.stepTimes[step] - ideal) / Simulator::ticksPerMicrosecond;
+      if(error > maxError) maxError = error;
+    }
+    int32_t expected = (int32_t)(SIM_SECONDS * speed); // first step is one interval after run()
+    bool ok = abs(motor.position - expected) <= 1 && maxError <= MAX_ERROR_USEC;
+    if(!ok) pass = false;
+    totalSteps += motor.position;
+    Serial.printlnf("Stepper %2d: %6ld steps (expected %6ld), max error %5.1f usec %s", i, (long)motor.position, (long)expected, maxError, ok ? "" : "FAIL");
+  }
+
+  ISRStats stats;
+  VDW_Stepper::getISRStats(stats);
+  Serial.printlnf("%llu steps, %lu interrupts, %lu missed deadlines", (unsigned long long)totalSteps, (unsigned long)(Simulator::interruptCount - interrupts), (unsigned long)stats.missedDeadlines);
+  Serial.printlnf("%d simulated seconds in %.3f seconds (%.0fx real time)", SIM_SECONDS, wallTime, SIM_SECONDS / wallTime);
+  return pass;
+}
+
+int main(){
+  Simulator::ticksPerRead = ISR_COST_TICKS;
+  Simulator::maxLatencyTicks = LATENCY_TICKS;
+  initSteppers<SIM_STEPPERS + CHECK_AXES>();
+
+  bool pass = true;
+  bool (*const checks[])() = {checkRamp, checkSCurve, checkQueue, checkCommands, checkMailbox, checkBlend, checkGroup, checkGroupStop, checkTimers, checkSlowSteps, checkRegistry, checkHoming, checkPinSteps, checkSharedSCurves, checkCompiled, checkStream, checkFeedOverride, checkTiming};
+  for(uint8_t i=0; i<sizeof(checks) / sizeof(checks[0]); i++){
+    if(!checks[i]()) pass = false;
+    Serial.println();
+  }
+
+  Serial.printlnf(pass ? "PASS" : "FAIL");
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,34 @@
+/*
+ * Project VDW_Stepper
+ * Description: Binary move stream. Two steppers take their moves from a host over Serial as 16 byte
+ *   binary frames (see VDW_StepperStream.h). The host sends STREAM_SYNC, then one move per credit it is
+ *   granted, so the move queues never overflow or run dry.
+ * Author:
+ * Date:
+ */
+
+#include "VDW_Stepper.h"
+#include "VDW_StepperStream.h"
+
+VDW_Stepper xAxis;
+VDW_Stepper yAxis;
+StepperStream moveStream;
+
+SYSTEM_MODE(MANUAL);
+
+void setup() {
+  Serial.begin(921600);
+
+  xAxis.initPins(D0, D1, D2);
+  yAxis.initPins(D3, D4, D5);
+  xAxis.setAcceleration(20000*1000);
+  yAxis.setAcceleration(20000*1000);
+
+  moveStream.add(xAxis); // stepper 0
+  moveStream.add(yAxis); // stepper 1
+  moveStream.begin(Serial);
+}
+
+void loop() {
+  moveStream.update();
+}
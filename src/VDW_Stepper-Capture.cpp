@@ -0,0 +1,104 @@
+#include "VDW_Stepper.h"
+
+#if defined(STEP_CAPTURE)
+uint8_t VDW_Stepper::captureBuffer[STEP_CAPTURE_SIZE];
+volatile uint16_t VDW_Stepper::captureHead = 0;
+volatile uint16_t VDW_Stepper::captureTail = 0;
+volatile bool VDW_Stepper::capturing = false;
+bool VDW_Stepper::captureSync = true;
+bool VDW_Stepper::captureHeader = false;
+uint32_t VDW_Stepper::captureTicks = 0;
+uint32_t VDW_Stepper::captureLastTicks = 0;
+volatile uint32_t VDW_Stepper::captureDropped = 0;
+uint32_t VDW_Stepper::captureDroppedReported = 0;
+
+void VDW_Stepper::startCapture(){
+  if(VDW_Stepper::capturing) return;
+  // Run_ISR() does not write the ring while capturing is off, the records of the last capture stay to be dumped
+  VDW_Stepper::captureSync = true;
+  VDW_Stepper::captureHeader = false;
+  MemoryBarrier();
+  VDW_Stepper::capturing = true;
+}
+
+void VDW_Stepper::stopCapture(){
+  VDW_Stepper::capturing = false;
+}
+
+static_assert(MAX_STEPPER_SLOTS <= 64, "step capture records hold the slot in 6 bits, MAX_STEPPER_SLOTS must be 64 or less");
+
+void VDW_Stepper::captureStep(uint8_t slot, bool direction, int32_t lateness){
+  uint8_t record[8];
+  uint8_t length = 0;
+  uint8_t header = (slot & 0x3F) | ((direction) ? 0x40 : 0);
+  uint32_t ticks = VDW_Stepper::captureTicks;
+  if(VDW_Stepper::captureSync){
+    record[length++] = header | 0x80;
+    record[length++] = ticks;
+    record[length++] = ticks >> 8;
+    record[length++] = ticks >> 16;
+    record[length++] = ticks >> 24;
+  }else{
+    record[length++] = header;
+    uint32_t delta = ticks - VDW_Stepper::captureLastTicks;
+    while(delta >= 0x80){
+      record[length++] = (delta & 0x7F) | 0x80;
+      delta >>= 7;
+    }
+    record[length++] = delta;
+  }
+  record[length++] = (int8_t)Constrain(lateness, -127, 127);
+
+  // Drop the step if it does not fit, the next record that fits is absolute
+  uint16_t tail = VDW_Stepper::captureTail;
+  uint16_t free = (VDW_Stepper::captureHead - tail - 1) & (STEP_CAPTURE_SIZE - 1);
+  if(free < length){
+    VDW_Stepper::captureDropped += 1;
+    VDW_Stepper::captureSync = true;
+    return;
+  }
+  for(uint8_t i=0; i<length; i++){
+    VDW_Stepper::captureBuffer[tail] = record[i];
+    tail = (tail + 1) & (STEP_CAPTURE_SIZE - 1);
+  }
+  MemoryBarrier();
+  VDW_Stepper::captureTail = tail;
+  VDW_Stepper::captureLastTicks = ticks;
+  VDW_Stepper::captureSync = false;
+}
+
+void VDW_Stepper::dumpCapture(Print &output){
+  static const char hex[] = "0123456789abcdef";
+  uint16_t head = VDW_Stepper::captureHead;
+  uint16_t tail = VDW_Stepper::captureTail;
+  if(head != tail && !VDW_Stepper::captureHeader){
+    output.printlnf("#STEPCAP ticksPerMicrosecond %lu", (unsigned long)CPU_TICKS_PER_MICROSECOND());
+    VDW_Stepper::captureHeader = true;
+  }
+
+  // The records are printed as they lie in the ring, the analyzer joins the lines back together
+  MemoryBarrier();
+  while(head != tail){
+    char line[2 + 2 * STEP_CAPTURE_LINE + 1];
+    uint8_t length = 0;
+    line[length++] = 'C';
+    line[length++] = ' ';
+    for(uint8_t i=0; i<STEP_CAPTURE_LINE && head != tail; i++){
+      uint8_t value = VDW_Stepper::captureBuffer[head];
+      line[length++] = hex[value >> 4];
+      line[length++] = hex[value & 0x0F];
+      head = (head + 1) & (STEP_CAPTURE_SIZE - 1);
+    }
+    line[length] = 0;
+    MemoryBarrier();
+    VDW_Stepper::captureHead = head;
+    output.println(line);
+  }
+
+  uint32_t dropped = VDW_Stepper::captureDropped;
+  if(dropped != VDW_Stepper::captureDroppedReported){
+    output.printlnf("#STEPCAP dropped %lu", (unsigned long)(dropped - VDW_Stepper::captureDroppedReported));
+    VDW_Stepper::captureDroppedReported = dropped;
+  }
+}
+#endif
@@ -0,0 +1,122 @@
+#include "VDW_Stepper.h"
+
+void VDW_Stepper::setCompiledBuffer(CompiledBuffer *buffer){
+  cancelCompiled();
+  _compiled = buffer;
+}
+
+void VDW_Stepper::compileMoves(){
+  StepperPtr cStepper;
+  for(uint8_t slot = 0; (cStepper = VDW_Stepper::nextActive(slot)) != nullptr; slot++){
+    if(cStepper->_compiledPlaying) cStepper->compileChunks();
+  }
+}
+
+void VDW_Stepper::startCompiled(){
+  // Moves that reverse are planned while moving, only single ramps from rest are compiled
+  if(_ramp.hasNextPlan) return;
+
+  CompiledBuffer &buffer = *_compiled;
+  buffer.chunk[0].full = false;
+  buffer.chunk[1].full = false;
+  buffer.fillChunk = 0;
+  buffer.playChunk = 0;
+  buffer.playIndex = 0;
+  buffer.cursor = _ramp;
+  buffer.cursorInterval = _stepInterval;
+  buffer.lastInterval = _stepInterval;
+  buffer.done = false;
+  _compiledPlaying = true;
+  compileChunks();
+}
+
+void VDW_Stepper::compileChunks(){
+  CompiledBuffer &buffer = *_compiled;
+  bool direction = buffer.cursor.plan.direction;
+  while(_compiledPlaying && !buffer.done){
+    CompiledChunk &chunk = buffer.chunk[buffer.fillChunk];
+    if(chunk.full) return; // both chunks are waiting to be played
+
+    // Leave room for an absolute interval at the end of the chunk
+    uint16_t length = 0;
+    while(length <= COMPILED_CHUNK_SIZE - 3 && !buffer.done){
+      int32_t interval = computeRampInterval(buffer.cursor, buffer.cursorInterval, direction);
+      int32_t change = interval - buffer.lastInterval;
+      if(interval <= 0){
+        chunk.entry[length++] = COMPILED_END;
+        buffer.done = true;
+      }else if(change > INT16_MAX || change <= COMPILED_END){
+        chunk.entry[length++] = COMPILED_ABSOLUTE;
+        chunk.entry[length++] = (uint32_t)interval >> 16;
+        chunk.entry[length++] = interval & 0xFFFF;
+        buffer.lastInterval = interval;
+      }else{
+        chunk.entry[length++] = change;
+        buffer.lastInterval = interval;
+      }
+    }
+
+    // Publish the chunk
+    chunk.length = length;
+    MemoryBarrier();
+    chunk.full = true;
+    buffer.fillChunk ^= 1;
+  }
+}
+
+int32_t VDW_Stepper::playCompiled(){
+  CompiledBuffer &buffer = *_compiled;
+  CompiledChunk &chunk = buffer.chunk[buffer.playChunk];
+  if(!chunk.full){
+    // The compiler fell behind, finish the move with the live ramp math
+    buffer.underruns += 1;
+    _compiledPlaying = false;
+    resumeLiveRamp(_ramp);
+    return computeRampInterval(_ramp, _stepInterval, _direction);
+  }
+  MemoryBarrier();
+
+  uint16_t index = buffer.playIndex;
+  int16_t entry = chunk.entry[index++];
+  int32_t interval;
+  if(entry == COMPILED_END){
+    interval = 0;
+    _compiledPlaying = false;
+  }else if(entry == COMPILED_ABSOLUTE){
+    interval = ((uint32_t)(uint16_t)chunk.entry[index] << 16) | (uint16_t)chunk.entry[index + 1];
+    index += 2;
+  }else{
+    interval = _stepInterval + entry;
+  }
+
+  // Hand a played chunk back to the compiler
+  if(index >= chunk.length){
+    index = 0;
+    MemoryBarrier();
+    chunk.full = false;
+    buffer.playChunk ^= 1;
+  }
+  buffer.playIndex = index;
+
+  // Keep the step count and interval current for getCurrentSpeed(), planStop() and resumeLiveRamp()
+  _ramp.step += 1;
+  if(interval > 0) _stepInterval = interval;
+  return interval;
+}
+
+void VDW_Stepper::resumeLiveRamp(RampState &ramp){
+  // Compiled moves start from rest, so the speed squared follows from the steps taken. Decelerations and
+  // S-curves do not carry it from step to step
+  uint32_t step = ramp.step;
+  ramp.q = (uint64_t)((step < ramp.plan.accelSteps) ? step : ramp.plan.accelSteps) * ramp.plan.deltaQ;
+  ramp.carry = 0;
+}
+
+void VDW_Stepper::cancelCompiled(){
+  if(!_compiledPlaying) return;
+
+  // Run_ISR() stops playback when it adopts the command
+  MotionCommand &motion = composeCommand();
+  resumeLiveRamp(motion.ramp);
+  postCommand(false);
+}
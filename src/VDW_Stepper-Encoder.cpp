@@ -0,0 +1,121 @@
+#include "VDW_Stepper.h"
+
+void VDW_Stepper::setEncoder(int32_t (*readEncoder)(), int32_t counts, int32_t steps, uint32_t followingWindow, uint32_t stallError, bool correct){
+  _readEncoder = readEncoder;
+  _encoderCounts = (counts != 0) ? counts : 1;
+  _encoderSteps = (steps != 0) ? steps : 1;
+  _followingWindow = followingWindow;
+  _stallError = stallError;
+  _encoderCorrect = correct;
+  _followingError = 0;
+  _encoderState = (readEncoder) ? ENCODER_OK : ENCODER_NONE;
+
+  // The motor is where it was told it is
+  if(readEncoder){
+    _encoderOffset = 0;
+    _encoderOffset = _position - encoderPosition();
+  }
+}
+
+int32_t VDW_Stepper::encoderPosition(){
+  if(_readEncoder == nullptr) return _position;
+  // Rounded to the nearest step
+  int64_t steps = (int64_t)_readEncoder() * _encoderSteps;
+  int64_t half = (steps < 0) ? -(_encoderCounts / 2) : _encoderCounts / 2;
+  return (steps + half) / _encoderCounts + _encoderOffset;
+}
+
+void VDW_Stepper::reconcileEncoders(){
+  for(uint8_t i=0; i<MAX_STEPPER_SLOTS; i++){
+    StepperPtr cStepper = VDW_Stepper::slots[i];
+    if(cStepper && cStepper->_readEncoder) cStepper->reconcileEncoder();
+  }
+}
+
+void VDW_Stepper::clearStall(){
+  if(_encoderState == ENCODER_STALLED) _encoderState = ENCODER_OK;
+}
+
+void VDW_Stepper::reconcileEncoder(){
+  int32_t error = _position - encoderPosition();
+  _followingError = error;
+  uint32_t size = abs(error);
+
+  // Back within the window, corrections that follow are a new error
+  if(size <= _followingWindow) _encoderCorrecting = 0;
+
+  // Stall, stop dead where the motor actually is. A motor that keeps losing steps while they are corrected
+  // is stalled too
+  if(_stallError > 0 && (uint32_t)abs(_encoderCorrecting + error) >= _stallError){
+    noInterrupts();
+    _adoptedSeq = _commandSeq; // drop a command Run_ISR() has not adopted
+    _stepTime = 0;
+    _stepInterval = 0;
+    _compiledPlaying = false;
+    _ramp.hasNextPlan = false;
+    _position -= error;
+    _target = _position;
+    interrupts();
+    finishGroup();
+    _resumeToTarget = false;
+    _holdQueue = false;
+    clearQueue();
+    _encoderState = ENCODER_STALLED;
+    _encoderStalls += 1;
+    _encoderCorrecting = 0;
+    return;
+  }
+  if(_encoderState == ENCODER_STALLED) return; // no corrections until clearStall()
+
+  if(size <= _followingWindow){
+    _encoderState = ENCODER_OK;
+    return;
+  }
+  _encoderState = ENCODER_FOLLOWING;
+  if(_encoderCorrect && correctFollowing(error)) _encoderState = ENCODER_OK;
+}
+
+bool VDW_Stepper::correctFollowing(int32_t error){
+  // At rest, go back to the target
+  if(_stepTime <= 0){
+    if(_holdQueue) return false; // paused
+    _position -= error;
+    moveAbsolute(_target);
+    _encoderCorrection += error;
+    _encoderCorrecting += error;
+    return true;
+  }
+
+  // Wait for Run_ISR() to adopt the last command, it was planned from _position
+  if(_commandSeq != _adoptedSeq) return false;
+
+  noInterrupts();
+  bool corrected = false;
+  int32_t behind = (_direction) ? error : -error; // steps behind along the direction of travel
+  if(_compiledPlaying || _ramp.hasNextPlan){
+    // Wait for the live ramp of a single move
+  }else if(!_hasTarget){
+    // Running indefinitely, there are no steps to make up
+    _position -= error;
+    _encoderCorrecting += error;
+    corrected = true;
+  }else if(_ramp.plan.deltaQ == 0){
+    // Constant speed runs until _position reaches _target
+    int32_t remaining = (_direction) ? _target - (_position - error) : (_position - error) - _target;
+    if(remaining > 0){
+      _position -= error;
+      _encoderCorrection += error;
+      _encoderCorrecting += error;
+      corrected = true;
+    }
+  }else if(_ramp.step > _ramp.plan.accelSteps && (int64_t)(_ramp.plan.steps - _ramp.step) + behind > _ramp.plan.decelSteps){
+    // Cruising, lengthen the cruise by the missing steps
+    _ramp.plan.steps += behind;
+    _position -= error;
+    _encoderCorrection += error;
+    _encoderCorrecting += error;
+    corrected = true;
+  }
+  interrupts();
+  return corrected;
+}
@@ -0,0 +1,133 @@
+#include "VDW_Stepper-HAL.h"
+
+#if defined(VDW_STEPPER_LINUX)
+
+SimSerial Serial;
+uint64_t Simulator::ticks = 0;
+uint32_t Simulator::ticksPerRead = 0;
+uint32_t Simulator::maxLatencyTicks = 0;
+uint32_t Simulator::interruptCount = 0;
+IntervalTimer* Simulator::timers[IntervalTimer::NUM_SIT] = {};
+SimPort Simulator::ports[SIM_PORTS];
+std::vector<SimMotor*> Simulator::motors;
+std::vector<Simulator::PinInterrupt> Simulator::pinInterrupts;
+bool Simulator::inInterrupt = false;
+std::vector<std::function<void()>> Simulator::pendingInterrupts;
+
+// Print
+size_t Print::printf(const char *format, ...){
+  va_list args;
+  va_start(args, format);
+  size_t size = printFormatted(false, format, args);
+  va_end(args);
+  return size;
+}
+
+size_t Print::printlnf(const char *format, ...){
+  va_list args;
+  va_start(args, format);
+  size_t size = printFormatted(true, format, args);
+  va_end(args);
+  return size;
+}
+
+size_t Print::printFormatted(bool newline, const char *format, va_list args){
+  char buffer[256];
+  int length = vsnprintf(buffer, sizeof(buffer), format, args);
+  if(length < 0) return 0;
+  size_t size = write((const uint8_t*)buffer, ((size_t)length < sizeof(buffer)) ? length : sizeof(buffer) - 1);
+  if(newline) size += print("\r\n");
+  return size;
+}
+
+// Interval Timer
+static uint64_t periodToTicks(intPeriod period, bool scale){
+  return (uint64_t)period * ((scale == hmSec) ? 500 : 1) * Simulator::ticksPerMicrosecond;
+}
+
+bool IntervalTimer::begin(ISRcallback isrCallback, intPeriod period, bool scale, TIMid id){
+  if(period < 10) return false; // as SparkIntervalTimer, the period is 16 bits
+  if(_slot < 0){
+    for(uint8_t i=0; i<NUM_SIT; i++){
+      if(id != AUTO && id != i) continue;
+      if(Simulator::timers[i] == nullptr){
+        Simulator::timers[i] = this;
+        _slot = i;
+        break;
+      }
+    }
+    if(_slot < 0) return false; // no timer available
+  }
+  _callback = isrCallback;
+  _period = periodToTicks(period, scale);
+  _due = Simulator::ticks + _period; // the first interrupt is a period away
+  return true;
+}
+
+void IntervalTimer::end(){
+  if(_slot < 0) return;
+  Simulator::timers[_slot] = nullptr;
+  _slot = -1;
+}
+
+void IntervalTimer::resetPeriod_SIT(intPeriod newPeriod, bool scale){
+  _period = periodToTicks(newPeriod, scale);
+  _due = Simulator::ticks + _period;
+}
+
+// Simulator
+void Simulator::portWrite(SimPort *port, uint16_t set, uint16_t reset){
+  uint16_t rising = set & ~port->output;
+  uint16_t falling = reset & ~set & port->output;
+  port->output = (port->output | set) & ~(reset & ~set); // set wins, like BSRR
+  port->writes += 1;
+  if((rising | falling) && !pinInterrupts.empty()) pinEdges(port, rising, falling);
+  if(rising == 0) return;
+  for(size_t i=0; i<motors.size(); i++){
+    SimMotor *motor = motors[i];
+    if(pinPort(motor->_stepPin) != port || !(rising & pinMask(motor->_stepPin))) continue;
+    motor->step((pinPort(motor->_dirPin)->output & pinMask(motor->_dirPin)) ? 1 : -1);
+  }
+}
+
+void Simulator::pinEdges(SimPort *port, uint16_t rising, uint16_t falling){
+  for(size_t i=0; i<pinInterrupts.size(); i++){
+    const PinInterrupt &interrupt = pinInterrupts[i];
+    if(pinPort(interrupt.pin) != port) continue;
+    uint16_t edges = (interrupt.mode == RISING) ? rising : (interrupt.mode == FALLING) ? falling : (rising | falling);
+    if(!(edges & pinMask(interrupt.pin))) continue;
+    if(inInterrupt) pendingInterrupts.push_back(interrupt.handler);
+    else interrupt.handler();
+  }
+}
+
+void Simulator::runUntil(uint64_t time){
+  uint64_t end = time * ticksPerMicrosecond;
+  while(true){
+    // Earliest timer due before the end, lowest slot first when tied
+    IntervalTimer *next = nullptr;
+    for(uint8_t i=0; i<IntervalTimer::NUM_SIT; i++){
+      IntervalTimer *timer = timers[i];
+      if(timer && timer->_due <= end && (next == nullptr || timer->_due < next->_due)) next = timer;
+    }
+    if(next == nullptr) break;
+
+    uint64_t fire = next->_due + ((maxLatencyTicks) ? rand() % maxLatencyTicks : 0);
+    if(fire > ticks) ticks = fire; // a long interrupt delays the ones behind it
+    next->_due += (next->_period) ? next->_period : 1; // repeats unless the callback resets the period
+    interruptCount += 1;
+    inInterrupt = true;
+    next->_callback();
+    inInterrupt = false;
+
+    // Pin interrupts raised by the timer interrupt
+    while(!pendingInterrupts.empty()){
+      std::vector<std::function<void()>> handlers;
+      handlers.swap(pendingInterrupts);
+      for(size_t i=0; i<handlers.size(); i++) handlers[i]();
+    }
+  }
+  if(end > ticks) ticks = end;
+}
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef VDW_STEPPER_HAL_LINUX_H
+#define VDW_STEPPER_HAL_LINUX_H
+
+// Linux Backend
+// A discrete-event simulator that stands in for Device OS and SparkIntervalTimer so the real scheduler
+// can be compiled and run on a PC. Time only moves when the simulator is told to run: Simulator::runUntil()
+// fires each IntervalTimer at the exact tick it is due, in order, and advances the virtual clock in between,
+// so hours of motion take milliseconds. There are no real interrupts, noInterrupts()/interrupts() do nothing.
+//
+// Build a host program with the library sources, ie:
+//   g++ -std=c++11 -O2 -Isrc my_test.cpp src/VDW_Stepper*.cpp -o my_test
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <functional>
+
+// PRINT
+// The subset of Particle's Print used by the library
+class Print{
+public:
+  virtual ~Print(){}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size){
+    for(size_t i=0; i<size; i++) write(buffer[i]);
+    return size;
+  }
+  size_t print(const char *text){ return write((const uint8_t*)text, strlen(text)); }
+  size_t println(const char *text = ""){ return print(text) + print("\r\n"); }
+  size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+  size_t printlnf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+private:
+  size_t printFormatted(bool newline, const char *format, va_list args);
+};
+
+// STREAM
+// The subset of Particle's Stream used by the library
+class Stream : public Print{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+};
+
+// Serial
+// Writes to stdout, never receives anything
+class SimSerial : public Stream{
+public:
+  void begin(uint32_t){}
+  size_t write(uint8_t c){ return (fputc(c, stdout) == EOF) ? 0 : 1; }
+  using Print::write;
+  int available(){ return 0; }
+  int read(){ return -1; }
+};
+extern SimSerial Serial;
+
+// Simulated Stream
+// A serial link to a simulated host: the library reads what the host puts in input, and what the library
+// writes is added to output
+class SimStream : public Stream{
+public:
+  std::vector<uint8_t> input;
+  size_t inputRead = 0; // bytes of input already read
+  std::vector<uint8_t> output;
+
+  size_t write(uint8_t c){ output.push_back(c); return 1; }
+  using Print::write;
+  int available(){ return input.size() - inputRead; }
+  int read(){ return (inputRead < input.size()) ? input[inputRead++] : -1; }
+};
+
+inline void noInterrupts(){}
+inline void interrupts(){}
+
+// GPIO
+// Pins are numbered port * 16 + bit
+#define SIM_PORTS 4
+enum {LOW, HIGH};
+enum {INPUT, OUTPUT, INPUT_PULLUP, INPUT_PULLDOWN};
+enum InterruptMode {CHANGE, RISING, FALLING};
+struct SimPort{
+  uint16_t output = 0; // pin states
+  uint32_t writes = 0; // register writes, to count the cost of step output
+};
+
+// SPARK INTERVAL TIMER
+enum {uSec, hmSec}; // microseconds or half-milliseconds
+typedef uint16_t intPeriod;
+enum TIMid {TIMER3, TIMER4, TIMER5, TIMER6, TIMER7, AUTO=255};
+
+// Interval Timer
+// Simulated SparkIntervalTimer. Like the hardware, the first interrupt comes as soon as the timer begins,
+// resetPeriod_SIT() restarts the count from the time it is called, and the timer repeats at the period
+// until it is reset again or ended.
+class IntervalTimer{
+public:
+  static const uint8_t NUM_SIT = 5;
+  typedef void (*ISRcallback)();
+
+  bool begin(ISRcallback isrCallback, intPeriod period, bool scale){ return begin(isrCallback, period, scale, AUTO); }
+  bool begin(ISRcallback isrCallback, intPeriod period, bool scale, TIMid id);
+  void end();
+  void resetPeriod_SIT(intPeriod newPeriod, bool scale);
+
+private:
+  friend class Simulator;
+  int8_t _slot = -1; // index in Simulator::timers, -1 == not allocated
+  ISRcallback _callback = nullptr;
+  uint64_t _due = 0; // virtual time of the next interrupt (ticks)
+  uint64_t _period = 0; // ticks
+};
+
+class SimMotor;
+
+// SIMULATOR
+// Virtual clock, interrupt dispatch and GPIO
+class Simulator{
+public:
+  static const uint32_t ticksPerMicrosecond = 120; // Photon, 120MHz
+  static uint64_t ticks; // the virtual clock
+  static uint32_t ticksPerRead; // every CPU_Ticks() advances the clock, to model the cost of Run_ISR(). 0 == free
+  static uint32_t maxLatencyTicks; // interrupts fire up to this many ticks late (random). 0 == exactly on time
+  static uint32_t interruptCount; // interrupts fired
+
+  static uint32_t readTicks(){ ticks += ticksPerRead; return (uint32_t)ticks; }
+  static uint64_t micros(){ return ticks / ticksPerMicrosecond; }
+
+  // GPIO
+  static SimPort ports[SIM_PORTS];
+  static SimPort* pinPort(uint16_t pin){ return &ports[(pin >> 4) % SIM_PORTS]; }
+  static uint16_t pinMask(uint16_t pin){ return 1 << (pin & 15); }
+  static void portWrite(SimPort *port, uint16_t set, uint16_t reset);
+
+  // Pin Interrupts
+  // Edges on a pin with an attached interrupt call its handler. Edges raised inside an interrupt (ie a limit
+  // switch hit by a step) are held until the interrupt returns, like an interrupt of the same priority.
+  struct PinInterrupt{
+    uint16_t pin;
+    InterruptMode mode;
+    std::function<void()> handler;
+  };
+  static std::vector<PinInterrupt> pinInterrupts;
+
+  // Run Until
+  // Fires every timer interrupt that is due up to time, in order, then sets the clock to time
+  // \param[uint64_t] time - virtual time to run to (u-sec)
+  static void runUntil(uint64_t time);
+  static void runFor(uint64_t duration){ runUntil(micros() + duration); }
+
+private:
+  friend class IntervalTimer;
+  friend class SimMotor;
+  static IntervalTimer* timers[IntervalTimer::NUM_SIT];
+  static std::vector<SimMotor*> motors; // motors attached to pins
+  static bool inInterrupt; // true while a timer callback runs
+  static std::vector<std::function<void()>> pendingInterrupts; // pin interrupts raised while inInterrupt
+  static void pinEdges(SimPort *port, uint16_t rising, uint16_t falling);
+};
+
+// Simulated Motor
+// Records the position and the virtual time (ticks) of every step. Call step() from the step callbacks:
+//   stepper.init([](){ motor.step(1); }, [](){ motor.step(-1); });
+// or attach() it to the pins given to initPins() to step on each rising edge of the step pin.
+class SimMotor{
+public:
+  int32_t position = 0;
+  std::vector<uint64_t> stepTimes; // ticks
+  bool record = true; // false to only count position
+  bool stalled = false; // true to lose every step, ie the load is over the torque limit
+  int32_t encoderCounts = 1; // encoder counts per encoderSteps steps
+  int32_t encoderSteps = 1;
+  void step(int8_t direction){
+    if(!stalled) position += direction;
+    if(record) stepTimes.push_back(Simulator::ticks);
+    if(_limitPin >= 0) updateLimit();
+  }
+
+  // Encoder
+  // The count of an encoder on the motor shaft
+  int32_t encoder(){ return (int64_t)position * encoderCounts / encoderSteps; }
+
+  // Attach Limit
+  // Drives a limit switch input: high while the motor is at or below position (or at or above it, atMax)
+  void attachLimit(uint16_t pin, int32_t position, bool atMax=false){
+    _limitPin = pin;
+    _limitPosition = position;
+    _limitAtMax = atMax;
+    updateLimit();
+  }
+
+  // Attach
+  // Steps the motor on rising edges of stepPin, clockwise (+1) while dirPin is high
+  void attach(uint16_t stepPin, uint16_t dirPin){
+    _stepPin = stepPin;
+    _dirPin = dirPin;
+    Simulator::motors.push_back(this);
+  }
+
+private:
+  friend class Simulator;
+  uint16_t _stepPin = 0;
+  uint16_t _dirPin = 0;
+  int32_t _limitPin = -1; // -1 == no limit switch
+  int32_t _limitPosition = 0;
+  bool _limitAtMax = false;
+
+  void updateLimit(){
+    bool active = (_limitAtMax) ? (position >= _limitPosition) : (position <= _limitPosition);
+    SimPort *port = Simulator::pinPort(_limitPin);
+    uint16_t mask = Simulator::pinMask(_limitPin);
+    if(active != ((port->output & mask) != 0)) Simulator::portWrite(port, (active) ? mask : 0, (active) ? 0 : mask);
+  }
+};
+
+// Particle pin functions
+inline void pinMode(uint16_t, uint8_t){}
+inline void digitalWrite(uint16_t pin, uint8_t value){
+  Simulator::portWrite(Simulator::pinPort(pin), (value) ? Simulator::pinMask(pin) : 0, (value) ? 0 : Simulator::pinMask(pin));
+}
+inline int32_t digitalRead(uint16_t pin){ return (Simulator::pinPort(pin)->output & Simulator::pinMask(pin)) ? HIGH : LOW; }
+inline bool attachInterrupt(uint16_t pin, void (*handler)(), InterruptMode mode){
+  Simulator::pinInterrupts.push_back({pin, mode, handler});
+  return true;
+}
+template<typename T> bool attachInterrupt(uint16_t pin, void (T::*handler)(), T *instance, InterruptMode mode){
+  Simulator::pinInterrupts.push_back({pin, mode, [handler, instance](){ (instance->*handler)(); }});
+  return true;
+}
+inline void detachInterrupt(uint16_t pin){
+  for(size_t i=0; i<Simulator::pinInterrupts.size(); i++){
+    if(Simulator::pinInterrupts[i].pin == pin) Simulator::pinInterrupts.erase(Simulator::pinInterrupts.begin() + i--);
+  }
+}
+
+// Particle time functions, on the virtual clock
+inline uint32_t micros(){ return Simulator::micros(); }
+inline uint32_t millis(){ return Simulator::micros() / 1000; }
+inline void delay(uint32_t ms){ Simulator::runFor((uint64_t)ms * 1000); }
+
+#endif
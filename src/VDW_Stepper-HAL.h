@@ -0,0 +1,53 @@
+#ifndef VDW_STEPPER_HAL_H
+#define VDW_STEPPER_HAL_H
+
+// Hardware/Platform Abstractions
+// Everything VDW_Stepper needs from the platform:
+//   CPU_Ticks()                  - free-running 32 bit CPU cycle counter
+//   CPU_TICKS_PER_MICROSECOND()  - CPU_Ticks() per u-sec
+//   Constrain(value, min, max)   - clamp value to [min, max]
+//   MemoryBarrier()              - full memory barrier between thread and interrupt
+//   noInterrupts(), interrupts() - disable/enable interrupts around short reads
+//   IntervalTimer                - SparkIntervalTimer compatible hardware timer (begin, end, resetPeriod_SIT)
+//   Print, Serial                - printf()/printlnf() output for logging
+//   Stream                       - available()/read() input, for StepperStream
+//   GPIOPort                     - a GPIO port, for step pins set with initPins()
+//   Pin_Port(pin), Pin_Mask(pin) - the port of a pin and its bit in the port
+//   Port_Write(port, set, reset) - sets and clears pins of a port in one atomic write (BSRR)
+//   pinMode(), digitalWrite()    - configure and write a single pin
+//   digitalRead(), attachInterrupt(), detachInterrupt() - read a single pin and call a handler on its edges, for homing
+//
+// Particle devices (the default) use Device OS and SparkIntervalTimer. Host builds on Linux, or any build
+// that defines VDW_STEPPER_LINUX, use the discrete-event simulator in VDW_Stepper-HAL-Linux.h.
+#if defined(__linux__) && !defined(SPARK) && !defined(VDW_STEPPER_LINUX)
+  #define VDW_STEPPER_LINUX
+#endif
+
+#if defined(VDW_STEPPER_LINUX)
+  #include "VDW_Stepper-HAL-Linux.h"
+  #define CPU_Ticks() (Simulator::readTicks())
+  #define CPU_TICKS_PER_MICROSECOND() (Simulator::ticksPerMicrosecond)
+  #define Constrain(value, min, max) ((value) < (min) ? (min) : ((value) > (max) ? (max) : (value)))
+  #define MemoryBarrier() (__sync_synchronize())
+  typedef SimPort* GPIOPort;
+  #define Pin_Port(pin) (Simulator::pinPort(pin))
+  #define Pin_Mask(pin) (Simulator::pinMask(pin))
+  #define Port_Write(port, set, reset) (Simulator::portWrite((port), (set), (reset)))
+#else
+  #ifndef PARTICLE
+    #define PARTICLE
+  #endif
+  #include "Particle.h"
+  #include "SparkIntervalTimer.h"
+  #define CPU_Ticks() (System.ticks())
+  #define CPU_TICKS_PER_MICROSECOND() (System.ticksPerMicrosecond())
+  #define Constrain(value, min, max) (constrain(value, min, max))
+  #define MemoryBarrier() (__sync_synchronize())
+  typedef GPIO_TypeDef* GPIOPort;
+  #define Pin_Port(pin) (HAL_Pin_Map()[pin].gpio_peripheral)
+  #define Pin_Mask(pin) (HAL_Pin_Map()[pin].gpio_pin)
+  // BSRRL (set) and BSRRH (reset) are adjacent 16 bit registers, one 32 bit write updates both at once
+  #define Port_Write(port, set, reset) (*(volatile uint32_t*)&(port)->BSRRL = (uint32_t)(set) | ((uint32_t)(reset) << 16))
+#endif
+
+#endif
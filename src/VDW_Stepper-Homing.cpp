@@ -0,0 +1,119 @@
+#include "VDW_Stepper.h"
+
+bool VDW_Stepper::home(uint16_t limitPin, int32_t speed, uint32_t touchSpeed, uint32_t backoff, int32_t position, bool activeHigh){
+  if(isRunning()) return false;
+  if(speed == 0) speed = _speed;
+  if(_safeSpeed > 0) speed = Constrain(speed, -_safeSpeed, _safeSpeed);
+
+  // Release the switch of an earlier home()
+  if(_homeAttached) detachInterrupt(_homePin);
+  _homeAttached = false;
+
+  if(speed == 0 || digitalRead(limitPin) == ((activeHigh) ? HIGH : LOW)){
+    _homingState = HOMING_FAILED;
+    return false;
+  }
+
+  _homePin = limitPin;
+  _homeDirection = (speed > 0);
+  _homeSpeed = abs(speed);
+  _homeTouchSpeed = touchSpeed;
+  _homeBackoff = backoff;
+  _homePosition = position;
+  _homeLatched = false;
+  _homeStopping = false;
+  _homingState = HOMING_SEEKING;
+  attachInterrupt(limitPin, &VDW_Stepper::homeISR, this, (activeHigh) ? RISING : FALLING);
+  _homeAttached = true;
+
+  run(NoChange, speed);
+  return true;
+}
+
+HomingState VDW_Stepper::homingState(){
+  HomingState state = _homingState;
+  if((state == HOMING_SEEKING || state == HOMING_TOUCHING) && _homeLatched){
+    // Run_ISR() stops the motor at its next step once the switch is latched. A move that ended on the step
+    // that hit the switch is already stopped
+    if(!_homeStopping && !isRunning()) _homeStopping = true;
+    if(!_homeStopping){
+      // Waiting for Run_ISR()
+    }else if(state == HOMING_SEEKING && _homeTouchSpeed > 0){
+      // Back off past the latch, then touch again from far enough away to reach the touch speed. The
+      // interrupt ignores the switch until the touch is the last move left
+      int32_t away = (_homeDirection) ? -(int32_t)_homeBackoff : (int32_t)_homeBackoff;
+      queueMove(_homeLatch + away, NoChange, _homeSpeed);
+      queueMove(_homeLatch - away, ConstantSpeed, _homeTouchSpeed);
+      state = HOMING_TOUCHING;
+      _homingState = state;
+      _homeLatched = false;
+      MemoryBarrier();
+      _homeStopping = false;
+    }else if(!isRunning() && _commandSeq == _adoptedSeq){
+      // Stopped, Run_ISR() no longer counts steps. Move the coordinates so the latched point is the switch position
+      int32_t offset = _homePosition - _homeLatch;
+      _position += offset;
+      _target += offset;
+      _encoderOffset += offset;
+      state = HOMING_DONE;
+      _homingState = state;
+      _homeStopping = false;
+      _homeLatched = false;
+    }
+  }else if((state == HOMING_SEEKING || state == HOMING_TOUCHING) && !isRunning()){
+    // Stopped before the switch, ie stop() or the second touch ran its full distance
+    state = HOMING_FAILED;
+    _homingState = state;
+  }
+  if(state != HOMING_SEEKING && state != HOMING_TOUCHING && _homeAttached){
+    detachInterrupt(_homePin);
+    _homeAttached = false;
+  }
+  return state;
+}
+
+void VDW_Stepper::homeISR(){
+  HomingState state = _homingState;
+
+  // Only the first edge until homingState() takes it, the switch bounces. The second touch only once it is
+  // the last move left, moving toward the switch
+  if(state != HOMING_SEEKING && state != HOMING_TOUCHING) return;
+  if(_homeLatched) return;
+  if(state == HOMING_TOUCHING && (_queueHead != _queueTail || _direction != _homeDirection)) return;
+
+  // Latch the step count, Run_ISR() stops the motor at its next step and homingState() backs off or sets the position
+  _homeLatch = _position;
+  MemoryBarrier();
+  _homeLatched = true;
+}
+
+void VDW_Stepper::homeStop(){
+  // Decelerate along the ramp without planning a new one, planning divides. The seek starts from rest, so
+  // like an S-curve a trapezoid is as many steps from rest as it has ramped up (speed^2 grows by deltaQ a
+  // step). Anything else stops dead, ie the second touch, which is at constant speed
+  RampPlan &plan = _ramp.plan;
+  uint32_t stopSteps = 0;
+  if(!_compiledPlaying && plan.deltaQ > 0 && !plan.constantSpeed && !_ramp.hasNextPlan && (plan.sCurve || (plan.startQ == 0 && plan.accelerating))){
+    uint32_t step = _ramp.step;
+    stopSteps = plan.accelSteps;
+    if(plan.steps != RAMP_INDEFINITE && plan.steps - step <= plan.decelSteps) stopSteps = plan.steps - step;
+    else if(step < plan.accelSteps) stopSteps = step;
+  }
+
+  if(stopSteps == 0){
+    _stepTime = 0;
+    _stepInterval = 0;
+    _compiledPlaying = false;
+    _hasTarget = false;
+    _target = _position;
+  }else{
+    plan.steps = stopSteps;
+    plan.accelSteps = 0;
+    plan.decelSteps = stopSteps;
+    _ramp.step = 0;
+    _hasTarget = true;
+    _target = _position + ((_direction) ? (int32_t)stopSteps : -(int32_t)stopSteps);
+  }
+  _motionCount = _motionCount + 1;
+  _homeStopping = true;
+}
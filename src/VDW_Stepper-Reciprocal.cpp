@@ -0,0 +1,36 @@
+#include "VDW_Stepper.h"
+
+// Reciprocal Seeds
+// 2^22 / (64.5 + i), the reciprocal of the middle of each 1/64 slice of [1, 2) (Q16). Good to ~7 bits,
+// three Newton iterations bring it to full 32 bit precision.
+static const uint16_t reciprocalSeed[64] = {
+  65028, 64035, 63072, 62138, 61231, 60350, 59494, 58662,
+  57852, 57065, 56299, 55554, 54828, 54120, 53431, 52759,
+  52103, 51464, 50840, 50231, 49637, 49056, 48489, 47935,
+  47393, 46864, 46346, 45839, 45344, 44859, 44384, 43919,
+  43464, 43019, 42582, 42154, 41734, 41323, 40920, 40525,
+  40137, 39756, 39383, 39017, 38657, 38304, 37958, 37617,
+  37283, 36954, 36631, 36314, 36003, 35696, 35395, 35099,
+  34808, 34521, 34239, 33962, 33689, 33421, 33157, 32897,
+};
+
+uint32_t reciprocalDivide(uint32_t numerator, uint32_t divisor){
+  if(divisor == 0) return 0;
+
+  // Normalize the divisor to [2^31, 2^32) and estimate y = 2^63 / normalized
+  uint8_t shift = __builtin_clz(divisor);
+  uint32_t normalized = divisor << shift;
+  uint64_t y = (uint64_t)reciprocalSeed[(normalized >> 25) & 63] << 16;
+
+  // Newton iterations for 1/x: y' = y * (2 - x*y), each one doubles the correct bits (7, 14, 28, 32)
+  for(uint8_t i=0; i<3; i++){
+    int64_t error = (int64_t)((1ULL << 63) - (uint64_t)normalized * y); // 2^63 * (1 - x*y)
+    y += ((int64_t)y * (error >> 28)) >> 35;
+  }
+
+  // numerator / divisor = numerator * 2^shift * y / 2^63. y is never above the true reciprocal and is
+  // within 2^-31 of it, so the estimate is the quotient or one less, correct it with the remainder
+  uint32_t quotient = ((uint64_t)numerator * y) >> (63 - shift);
+  if(numerator - quotient * divisor >= divisor) quotient++;
+  return quotient;
+}
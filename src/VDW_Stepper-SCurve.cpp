@@ -0,0 +1,185 @@
+#include "VDW_Stepper.h"
+
+// S-Curve Ramp
+// Computes the timing of a 7 segment (jerk up, constant acceleration, jerk down) ramp from rest to
+// a cruise speed. The deceleration at the end of a move is the mirror image.
+// \param[double] speed - cruise speed (steps/sec)
+// \param[double] acceleration - maximum acceleration (steps/sec^2)
+// \param[double] jerk - maximum jerk (steps/sec^3)
+// \param[double&] jerkTime - returns the duration of each jerk segment (sec)
+// \param[double&] accelTime - returns the duration of the constant acceleration segment (sec)
+// \return[double] the distance covered by the ramp (steps)
+static double sCurveRamp(double speed, double acceleration, double jerk, double &jerkTime, double &accelTime){
+  if(speed * jerk < acceleration * acceleration){
+    // Maximum acceleration is never reached
+    jerkTime = sqrt(speed / jerk);
+    accelTime = 0;
+  }else{
+    jerkTime = acceleration / jerk;
+    accelTime = speed / acceleration - jerkTime;
+  }
+  return speed * (2 * jerkTime + accelTime) / 2;
+}
+
+// S-Curve State
+// Speed and position along the ramp at a time
+static void sCurveState(double t, double jerk, double jerkTime, double accelTime, double &speed, double &position){
+  double peakAccel = jerk * jerkTime;
+  double speed1 = jerk * jerkTime * jerkTime / 2;
+  double position1 = jerk * jerkTime * jerkTime * jerkTime / 6;
+  if(t <= jerkTime){
+    speed = jerk * t * t / 2;
+    position = jerk * t * t * t / 6;
+    return;
+  }
+  t -= jerkTime;
+  if(t <= accelTime){
+    speed = speed1 + peakAccel * t;
+    position = position1 + speed1 * t + peakAccel * t * t / 2;
+    return;
+  }
+  double speed2 = speed1 + peakAccel * accelTime;
+  double position2 = position1 + speed1 * accelTime + peakAccel * accelTime * accelTime / 2;
+  t -= accelTime;
+  speed = speed2 + peakAccel * t - jerk * t * t / 2;
+  position = position2 + speed2 * t + peakAccel * t * t / 2 - jerk * t * t * t / 6;
+}
+
+// S-Curve Table
+// Samples the ramp at even time intervals
+static void buildSCurveTable(SCurveTable &sCurve, double jerk, double jerkTime, double accelTime){
+  uint32_t maxInterval = milliStepsToUsecInterval(ULTIMATE_MIN_SPEED);
+  double rampTime = 2 * jerkTime + accelTime;
+  for(uint8_t i=0; i<SCURVE_TABLE_SIZE; i++){
+    double stepSpeed, position;
+    sCurveState(rampTime * i / (SCURVE_TABLE_SIZE - 1), jerk, jerkTime, accelTime, stepSpeed, position);
+    double interval = (stepSpeed > 0) ? 1000000.0 / stepSpeed : maxInterval;
+    sCurve.entry[i].position = position;
+    sCurve.entry[i].interval = (interval < maxInterval) ? interval : maxInterval;
+  }
+  for(uint8_t i=0; i<SCURVE_TABLE_SIZE; i++){
+    int64_t slope = 0;
+    if(i < SCURVE_TABLE_SIZE - 1){
+      uint32_t span = sCurve.entry[i+1].position - sCurve.entry[i].position;
+      int64_t change = (int64_t)sCurve.entry[i+1].interval - sCurve.entry[i].interval;
+      if(span > 0) slope = (change << SCURVE_SLOPE_SHIFT) / span;
+    }
+    sCurve.entry[i].slope = Constrain(slope, (int64_t)INT32_MIN, (int64_t)INT32_MAX);
+  }
+}
+
+// Referenced Tables
+// Bitmap of the S-curve tables a ramp refers to, the next plan is read first (see buildSCurve())
+static uint32_t referencedTables(const RampState &ramp){
+  uint32_t used = 0;
+  if(ramp.hasNextPlan && ramp.nextPlan.sCurve) used |= 1UL << ramp.nextPlan.sCurveTable;
+  MemoryBarrier();
+  if(ramp.plan.sCurve) used |= 1UL << ramp.plan.sCurveTable;
+  return used;
+}
+
+void VDW_Stepper::buildSCurve(RampPlan &plan, bool direction, uint32_t steps, int32_t speed){
+  double cruiseSpeed = abs(speed) / 1000.0;
+  double acceleration = activeAcceleration() / 1000.0;
+  double jerk = _jerk / 1000.0;
+  uint64_t deltaQ = accelerationToDeltaQ(activeAcceleration());
+  double jerkTime, accelTime;
+  double rampDistance = sCurveRamp(cruiseSpeed, acceleration, jerk, jerkTime, accelTime);
+
+  // Not enough room to reach the cruise speed, find the fastest speed that fits
+  if(steps != RAMP_INDEFINITE && 2 * rampDistance > steps){
+    double low = 0;
+    double high = cruiseSpeed;
+    for(uint8_t i=0; i<40; i++){
+      double mid = (low + high) / 2;
+      if(2 * sCurveRamp(mid, acceleration, jerk, jerkTime, accelTime) > steps) high = mid;
+      else low = mid;
+    }
+    // Whole mSteps/sec, the table is shared by the steppers with the same profile
+    cruiseSpeed = (uint32_t)(low * 1000) / 1000.0;
+    rampDistance = sCurveRamp(cruiseSpeed, acceleration, jerk, jerkTime, accelTime);
+  }
+  uint32_t profileSpeed = cruiseSpeed * 1000 + 0.5;
+
+  // Too short for an S-curve
+  uint32_t rampSteps = rampDistance;
+  if(rampSteps == 0 || speed == 0){
+    buildRamp(plan, direction, steps, 0, speed, deltaQ);
+    return;
+  }
+
+  // Share the table of the same profile, tables never change while they are used. Otherwise build one in a
+  // table no stepper's live ramp or posted command refers to. Run_ISR() only moves a table from the posted
+  // command to the live ramp, or from its next plan to its plan, so reading them in this order sees every
+  // table it can reach
+  uint32_t profileAcceleration = activeAcceleration();
+  uint8_t table = 0;
+  while(table < SCURVE_TABLES && !(VDW_Stepper::sCurveTables[table].speed == profileSpeed &&
+    VDW_Stepper::sCurveTables[table].acceleration == profileAcceleration && VDW_Stepper::sCurveTables[table].jerk == _jerk)) table++;
+  if(table == SCURVE_TABLES){
+    uint32_t used = 0;
+    for(uint8_t slot=0; slot<MAX_STEPPER_SLOTS; slot++){
+      StepperPtr stepper = VDW_Stepper::slots[slot];
+      if(stepper == nullptr) continue;
+      if(stepper->_commandSeq != stepper->_adoptedSeq) used |= referencedTables(stepper->_commands[stepper->_commandSeq & 1].ramp);
+      MemoryBarrier();
+      used |= referencedTables(stepper->_ramp);
+    }
+    // planRamp() replaces the other plan of the command being composed with a trapezoid or clears it
+    table = 0;
+    while(table < SCURVE_TABLES && (used & (1UL << table))) table++;
+    if(table == SCURVE_TABLES){
+      buildRamp(plan, direction, steps, 0, speed, deltaQ);
+      return;
+    }
+    buildSCurveTable(VDW_Stepper::sCurveTables[table], jerk, jerkTime, accelTime);
+    VDW_Stepper::sCurveTables[table].speed = profileSpeed;
+    VDW_Stepper::sCurveTables[table].acceleration = profileAcceleration;
+    VDW_Stepper::sCurveTables[table].jerk = _jerk;
+  }
+
+  uint32_t maxInterval = milliStepsToUsecInterval(ULTIMATE_MIN_SPEED);
+  double rampTime = 2 * jerkTime + accelTime;
+
+  // Time to the first step
+  double low = 0;
+  double high = rampTime;
+  for(uint8_t i=0; i<40; i++){
+    double mid = (low + high) / 2;
+    double stepSpeed, position;
+    sCurveState(mid, jerk, jerkTime, accelTime, stepSpeed, position);
+    if(position > 1) high = mid;
+    else low = mid;
+  }
+
+  plan.direction = direction;
+  plan.sCurve = true;
+  plan.sCurveTable = table;
+  plan.deltaQ = deltaQ;
+  plan.accelerating = true;
+  plan.steps = steps;
+  plan.accelSteps = rampSteps;
+  plan.decelSteps = (steps == RAMP_INDEFINITE) ? 0 : rampSteps;
+  plan.startQ = 0;
+  setCruiseRate(plan, profileSpeed);
+  if(plan.cruiseInterval > maxInterval){
+    plan.cruiseInterval = maxInterval;
+    plan.cruiseRemainder = 0;
+  }
+  plan.firstInterval = high * 1000000.0;
+}
+
+uint32_t VDW_Stepper::sCurveInterval(RampState &ramp, uint32_t position){
+  const SCurveTable &sCurve = sCurveTables[ramp.plan.sCurveTable];
+
+  // Move to the entry at or before position. Position changes by one step per call so this
+  // is usually zero or one iteration
+  uint8_t index = ramp.sCurveIndex;
+  while(index < SCURVE_TABLE_SIZE - 1 && position >= sCurve.entry[index + 1].position) index++;
+  while(index > 0 && position < sCurve.entry[index].position) index--;
+  ramp.sCurveIndex = index;
+
+  // Interpolate to position
+  const SCurveEntry &entry = sCurve.entry[index];
+  return entry.interval + (((int64_t)(position - entry.position) * entry.slope) >> SCURVE_SLOPE_SHIFT);
+}
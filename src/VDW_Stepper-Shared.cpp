@@ -1,88 +1,614 @@
 #include "VDW_Stepper.h"
+#include "VDW_StepperGroup.h"
+
+static_assert(STEP_TIMERS >= 1 && STEP_TIMERS <= 5, "STEP_TIMERS must be 1 to 5");
+static_assert(MAX_STEPPER_SLOTS % 32 == 0 && MAX_STEPPER_SLOTS < NO_SLOT, "MAX_STEPPER_SLOTS must be a multiple of 32, less than 255");
+static_assert(SCURVE_TABLES >= 1 && SCURVE_TABLES <= 32, "SCURVE_TABLES must be 1 to 32");
 
 // Initialize Static Members
-StepperPtr VDW_Stepper::head = nullptr;
-IntervalTimer VDW_Stepper::Step_Timer;
-volatile int VDW_Stepper::lastDuration = 0;
-bool VDW_Stepper::ISR_Enabled = false;
+StepperPtr VDW_Stepper::slots[MAX_STEPPER_SLOTS];
+uint32_t VDW_Stepper::slotMap[SLOT_WORDS];
+volatile uint32_t VDW_Stepper::activeMap[SLOT_WORDS];
+uint8_t VDW_Stepper::heapIndex[MAX_STEPPER_SLOTS];
+StepTimer VDW_Stepper::stepTimers[STEP_TIMERS];
+// Entries past STEP_TIMERS are never used, they wrap so Timer_ISR<> is only built for timers that exist
+void (*const VDW_Stepper::timerISR[5])() = {
+	VDW_Stepper::Timer_ISR<0>, VDW_Stepper::Timer_ISR<(1 % STEP_TIMERS)>, VDW_Stepper::Timer_ISR<(2 % STEP_TIMERS)>,
+	VDW_Stepper::Timer_ISR<(3 % STEP_TIMERS)>, VDW_Stepper::Timer_ISR<(4 % STEP_TIMERS)>,
+};
+Reciprocal VDW_Stepper::ticksPerMicrosecond;
+uint16_t VDW_Stepper::feedOverride = 100;
+volatile uint32_t VDW_Stepper::feedScale = 1UL << FEED_SCALE_SHIFT;
+GPIOPort VDW_Stepper::stepPorts[MAX_STEP_PORTS];
+uint8_t VDW_Stepper::numStepPorts = 0;
+uint16_t VDW_Stepper::stepPortSteps[MAX_STEP_PORTS];
+uint16_t VDW_Stepper::stepPortDirSet[MAX_STEP_PORTS];
+uint16_t VDW_Stepper::stepPortDirReset[MAX_STEP_PORTS];
+uint8_t VDW_Stepper::stepPortsUsed = 0;
+uint8_t VDW_Stepper::stepPulseWidth = STEP_PULSE_WIDTH;
+uint8_t VDW_Stepper::stepDirSetup = STEP_DIR_SETUP;
+uint8_t VDW_Stepper::stepDirHold = STEP_DIR_HOLD;
+SCurveTable VDW_Stepper::sCurveTables[SCURVE_TABLES];
+#if defined(ISR_LOG)
+LogEntry VDW_Stepper::logBuffer[ISR_LOG_SIZE];
+volatile uint8_t VDW_Stepper::logHead = 0;
+volatile uint8_t VDW_Stepper::logTail = 0;
+volatile uint32_t VDW_Stepper::logDropped = 0;
+uint32_t VDW_Stepper::logDroppedReported = 0;
+#endif
+#if defined(ISR_STATS)
+ISRStats VDW_Stepper::isrStats;
+uint64_t VDW_Stepper::isrTicksTotal = 0;
+uint32_t VDW_Stepper::isrWindowStart = 0;
+uint32_t VDW_Stepper::isrWindowCount = 0;
+uint32_t VDW_Stepper::isrLastWindowCount = 0;
+uint32_t VDW_Stepper::isrLastWindowTicks = 0;
+#endif
+
+
+// Registry
+bool VDW_Stepper::attach(){
+	if(_slot != NO_SLOT) return true;
+	for(uint8_t word=0; word<SLOT_WORDS; word++){
+		uint32_t free = ~VDW_Stepper::slotMap[word];
+		if(free == 0) continue;
+		_slot = (word << 5) + __builtin_ctz(free);
+		VDW_Stepper::slotMap[word] |= 1UL << (_slot & 31);
+		VDW_Stepper::slots[_slot] = this;
+		VDW_Stepper::heapIndex[_slot] = HEAP_NONE;
+		return true;
+	}
+	return false;
+}
+
+void VDW_Stepper::detach(){
+	if(_slot == NO_SLOT) return;
 
+	// Take the stepper out of its timer, Run_ISR() can not be part way through a pass while interrupts are disabled
+	noInterrupts();
+	StepTimer &timer = VDW_Stepper::stepTimers[_timer];
+	if(VDW_Stepper::heapIndex[_slot] != HEAP_NONE) heapRemove(timer, VDW_Stepper::heapIndex[_slot]);
+	if(_schedulePending){
+		for(uint8_t i = timer.scheduleQueueHead; i != timer.scheduleQueueTail; i = (i + 1) & (SCHEDULE_QUEUE_SIZE - 1)){
+			if(timer.scheduleQueue[i] == this) timer.scheduleQueue[i] = nullptr;
+		}
+		_schedulePending = false;
+	}
+	VDW_Stepper::activeMap[_slot >> 5] &= ~(1UL << (_slot & 31));
+	_adoptedSeq = _commandSeq;
+	_stepTime = 0;
+	_stepInterval = 0;
+	_compiledPlaying = false;
+	interrupts();
+
+	// The switch interrupt of an unfinished home() would call into a destroyed stepper
+	if(_homeAttached) detachInterrupt(_homePin);
+	_homeAttached = false;
+	if(_homingState == HOMING_SEEKING || _homingState == HOMING_TOUCHING) _homingState = HOMING_FAILED;
+
+	finishGroup();
+	_target = _position;
+	VDW_Stepper::slotMap[_slot >> 5] &= ~(1UL << (_slot & 31));
+	VDW_Stepper::slots[_slot] = nullptr;
+	_slot = NO_SLOT;
+}
+
+void VDW_Stepper::finishGroup(){
+	// Run_ISR() may finish the group first, read the pointer once
+	StepperGroup *group = _group;
+	if(group) group->finish();
+}
+
+StepperPtr VDW_Stepper::nextActive(uint8_t &slot){
+	for(uint8_t word = slot >> 5; word < SLOT_WORDS; word++){
+		uint32_t bits = VDW_Stepper::activeMap[word];
+		if(word == (slot >> 5)) bits &= ~0UL << (slot & 31); // bits from slot on
+		if(bits == 0) continue;
+		slot = (word << 5) + __builtin_ctz(bits);
+		return VDW_Stepper::slots[slot];
+	}
+	return nullptr;
+}
 
 // Print Steppers
 void VDW_Stepper::printSteppers(){
 	Serial.printlnf("------- Steppers -------");
-	StepperPtr cStepper = VDW_Stepper::head;
-	int index = 1;
-	while(cStepper != nullptr){
-		Serial.printlnf("  Stepper %d: %d",index++,cStepper);
-		cStepper = cStepper->next;
+	for(uint8_t i=0; i<MAX_STEPPER_SLOTS; i++){
+		if(VDW_Stepper::slots[i]) Serial.printlnf("  Stepper %d: %p",i+1,(void*)VDW_Stepper::slots[i]);
 	}
 	Serial.printlnf("------------------------");
 }
 
-// RUN ISR
-void VDW_Stepper::Run_ISR(){
-	// Check if ISR was disabled
-	if(VDW_Stepper::ISR_Enabled == false){
-		VDW_Stepper::lastDuration = 0;
-		VDW_Stepper::ISR_Enabled = true;
+#if defined(ISR_LOG)
+// ISR Log
+static const char* const logFormats[] = {
+	"Behind schedule: next step %ld usec overdue, %ld steppers running",
+	"Step edge queue full: %ld steppers deferred, %ld edges queued",
+	"Too many steppers running (%ld of %ld), stepper not scheduled",
+};
+
+void VDW_Stepper::logEvent(uint8_t event, int32_t arg1, int32_t arg2){
+	uint8_t tail = VDW_Stepper::logTail;
+	uint8_t next = (tail + 1) & (ISR_LOG_SIZE - 1);
+	if(next == VDW_Stepper::logHead){
+		VDW_Stepper::logDropped += 1;
+		return;
+	}
+	LogEntry &entry = VDW_Stepper::logBuffer[tail];
+	entry.timestamp = CPU_Ticks();
+	entry.event = event;
+	entry.arg1 = arg1;
+	entry.arg2 = arg2;
+	MemoryBarrier();
+	VDW_Stepper::logTail = next;
+}
+
+void VDW_Stepper::drainLog(Print &output){
+	while(VDW_Stepper::logHead != VDW_Stepper::logTail){
+		uint8_t head = VDW_Stepper::logHead;
+		MemoryBarrier();
+		LogEntry entry = VDW_Stepper::logBuffer[head];
+		MemoryBarrier();
+		VDW_Stepper::logHead = (head + 1) & (ISR_LOG_SIZE - 1);
+
+		output.printf("%lu ", (unsigned long)entry.timestamp);
+		output.printlnf(logFormats[entry.event], (long)entry.arg1, (long)entry.arg2);
+	}
+
+	uint32_t dropped = VDW_Stepper::logDropped;
+	if(dropped != VDW_Stepper::logDroppedReported){
+		output.printlnf("%lu log entries dropped", (unsigned long)(dropped - VDW_Stepper::logDroppedReported));
+		VDW_Stepper::logDroppedReported = dropped;
+	}
+}
+#endif
+
+#if defined(ISR_STATS)
+// ISR Statistics
+void VDW_Stepper::getISRStats(ISRStats &stats){
+	noInterrupts();
+	stats = VDW_Stepper::isrStats;
+	uint64_t total = VDW_Stepper::isrTicksTotal;
+	uint32_t windowCount = VDW_Stepper::isrLastWindowCount;
+	uint32_t windowTicks = VDW_Stepper::isrLastWindowTicks;
+	interrupts();
+	stats.meanTicks = (stats.invocations) ? total / stats.invocations : 0;
+	uint32_t ticksPerSecond = VDW_Stepper::ticksPerMicrosecond.divisor * 1000000;
+	stats.invocationsPerSecond = (windowTicks) ? (uint64_t)windowCount * ticksPerSecond / windowTicks : 0;
+}
+
+void VDW_Stepper::resetISRStats(){
+	noInterrupts();
+	VDW_Stepper::isrStats = ISRStats();
+	VDW_Stepper::isrTicksTotal = 0;
+	VDW_Stepper::isrWindowCount = 0;
+	VDW_Stepper::isrLastWindowCount = 0;
+	VDW_Stepper::isrLastWindowTicks = 0;
+	interrupts();
+}
+
+void VDW_Stepper::recordISRStats(uint32_t started, uint32_t ticks){
+	ISRStats &stats = VDW_Stepper::isrStats;
+	if(stats.invocations == 0 || ticks < stats.minTicks) stats.minTicks = ticks;
+	if(ticks > stats.maxTicks) stats.maxTicks = ticks;
+	stats.invocations += 1;
+	VDW_Stepper::isrTicksTotal += ticks;
+	uint8_t bucket = (ticks) ? 32 - __builtin_clz(ticks) : 0;
+	stats.histogram[(bucket < ISR_STATS_BUCKETS) ? bucket : ISR_STATS_BUCKETS - 1] += 1;
+
+	// Invocations per second of every timer together, counted over windows of a second. Timed in CPU ticks
+	// since each timer keeps its own scheduler time. getISRStats() divides
+	uint32_t elapsed = started - VDW_Stepper::isrWindowStart;
+	uint32_t ticksPerSecond = VDW_Stepper::ticksPerMicrosecond.divisor * 1000000;
+	if(VDW_Stepper::isrWindowCount++ == 0){
+		VDW_Stepper::isrWindowStart = started;
+	}else if(elapsed >= ticksPerSecond){
+		VDW_Stepper::isrLastWindowCount = VDW_Stepper::isrWindowCount - 1;
+		VDW_Stepper::isrLastWindowTicks = elapsed;
+		VDW_Stepper::isrWindowStart = started;
+		VDW_Stepper::isrWindowCount = 1;
+	}
+}
+
+// Step Statistics
+void VDW_Stepper::getStepStats(StepStats &stats){
+	noInterrupts();
+	stats = _stepStats;
+	int64_t total = _stepErrorTotal;
+	interrupts();
+	stats.meanError = (stats.steps) ? total / (int32_t)stats.steps : 0;
+}
+
+void VDW_Stepper::resetStepStats(){
+	noInterrupts();
+	_stepStats = StepStats();
+	_stepErrorTotal = 0;
+	interrupts();
+}
+
+void VDW_Stepper::recordStepError(int32_t error){
+	if(_stepStats.steps == 0 || error < _stepStats.minError) _stepStats.minError = error;
+	if(_stepStats.steps == 0 || error > _stepStats.maxError) _stepStats.maxError = error;
+	_stepStats.steps += 1;
+	_stepErrorTotal += error;
+	if(error > ISR_STATS_DEADLINE_TOLERANCE) VDW_Stepper::isrStats.missedDeadlines += 1;
+}
+#endif
+
+// Step Ports
+uint8_t VDW_Stepper::stepPortIndex(GPIOPort port){
+	for(uint8_t i=0; i<VDW_Stepper::numStepPorts; i++){
+		if(VDW_Stepper::stepPorts[i] == port) return i;
+	}
+	if(VDW_Stepper::numStepPorts >= MAX_STEP_PORTS) return MAX_STEP_PORTS;
+	VDW_Stepper::stepPorts[VDW_Stepper::numStepPorts] = port;
+	return VDW_Stepper::numStepPorts++;
+}
+
+void VDW_Stepper::raiseStepPins(){
+	for(uint8_t used = VDW_Stepper::stepPortsUsed; used; used &= used - 1){
+		uint8_t i = __builtin_ctz(used);
+		if(VDW_Stepper::stepPortSteps[i]) Port_Write(VDW_Stepper::stepPorts[i], VDW_Stepper::stepPortSteps[i], 0);
+	}
+}
+
+void VDW_Stepper::queueStepEdge(StepTimer &timer, uint32_t due){
+	StepEdge &edge = timer.edges[(timer.edgeHead + timer.edgeCount++) & (STEP_EDGE_QUEUE_SIZE - 1)];
+	edge.due = due;
+	edge.portsUsed = VDW_Stepper::stepPortsUsed;
+	for(uint8_t used = VDW_Stepper::stepPortsUsed; used; used &= used - 1){
+		uint8_t i = __builtin_ctz(used);
+		edge.steps[i] = VDW_Stepper::stepPortSteps[i];
+		edge.dirSet[i] = VDW_Stepper::stepPortDirSet[i];
+		edge.dirReset[i] = VDW_Stepper::stepPortDirReset[i];
+		VDW_Stepper::stepPortSteps[i] = 0;
+		VDW_Stepper::stepPortDirSet[i] = 0;
+		VDW_Stepper::stepPortDirReset[i] = 0;
+	}
+	VDW_Stepper::stepPortsUsed = 0;
+}
+
+void VDW_Stepper::lowerStepEdges(StepTimer &timer, uint32_t now){
+	while(timer.edgeCount > 0 && (int32_t)(now - timer.edges[timer.edgeHead].due) >= 0){
+		const StepEdge &edge = timer.edges[timer.edgeHead];
+		for(uint8_t used = edge.portsUsed; used; used &= used - 1){
+			uint8_t i = __builtin_ctz(used);
+			Port_Write(VDW_Stepper::stepPorts[i], edge.dirSet[i], edge.steps[i] | edge.dirReset[i]);
+		}
+		timer.edgeHead = (timer.edgeHead + 1) & (STEP_EDGE_QUEUE_SIZE - 1);
+		timer.edgeCount--;
+	}
+}
+
+// Choose Timer
+uint8_t VDW_Stepper::chooseTimer(){
+	if(_timerHint >= 0 && !VDW_Stepper::stepTimers[_timerHint].unavailable) return _timerHint;
+
+	// Expected step rate of each timer
+	uint64_t load[STEP_TIMERS] = {};
+	StepperPtr cStepper;
+	for(uint8_t slot = 0; (cStepper = nextActive(slot)) != nullptr; slot++){
+		if(cStepper == this || !cStepper->isRunning()) continue;
+		load[cStepper->_timer] += abs(cStepper->activeSpeed());
+	}
+
+	// First timer with room, the least loaded if they are all full
+	uint32_t rate = abs(activeSpeed());
+	uint8_t timer = 0;
+	for(uint8_t i=0; i<STEP_TIMERS; i++){
+		if(i > 0 && VDW_Stepper::stepTimers[i].unavailable) continue;
+		if(load[i] + rate <= STEP_TIMER_MAX_RATE) return i;
+		if(load[i] < load[timer]) timer = i;
+	}
+	return timer;
+}
+
+// Feed Override
+void VDW_Stepper::setFeedOverride(uint16_t percent){
+	percent = Constrain(percent, MIN_FEED_OVERRIDE, MAX_FEED_OVERRIDE);
+	VDW_Stepper::feedOverride = percent;
+	VDW_Stepper::feedScale = ((uint32_t)100 << FEED_SCALE_SHIFT) / percent;
+}
+
+// Step Timing
+void VDW_Stepper::setStepTiming(uint8_t pulseWidth, uint8_t dirSetup, uint8_t dirHold){
+	VDW_Stepper::stepPulseWidth = (pulseWidth) ? pulseWidth : 1;
+	VDW_Stepper::stepDirSetup = dirSetup;
+	VDW_Stepper::stepDirHold = dirHold;
+}
+
+void VDW_Stepper::setTimer(int8_t timer){
+	_timerHint = (timer >= 0 && timer < STEP_TIMERS) ? timer : -1;
+}
+
+// Request Schedule
+void VDW_Stepper::requestSchedule(){
+	if(_schedulePending) return; // Run_ISR() reads _stepTime when it takes the stepper from the queue
+	StepTimer &timer = VDW_Stepper::stepTimers[_timer];
+	_schedulePending = true;
+	timer.scheduleQueue[timer.scheduleQueueTail] = this;
+	__atomic_fetch_or(&VDW_Stepper::activeMap[_slot >> 5], 1UL << (_slot & 31), __ATOMIC_RELAXED); // Run_ISR() may clear other bits of the word
+	MemoryBarrier();
+	timer.scheduleQueueTail = (timer.scheduleQueueTail + 1) & (SCHEDULE_QUEUE_SIZE - 1);
+}
+
+// Scheduler Clock
+uint32_t VDW_Stepper::schedulerClock(StepTimer &timer){
+	uint32_t ticks = CPU_Ticks();
+	uint32_t elapsed = ticks - timer.schedulerTicks + timer.schedulerTickRemainder;
+	timer.schedulerTicks = ticks;
+	timer.schedulerTime += VDW_Stepper::ticksPerMicrosecond.divide(elapsed, timer.schedulerTickRemainder);
+	return timer.schedulerTime;
+}
+
+// DUE HEAP
+// Entries compare by dueTime, wrap safe
+void VDW_Stepper::heapSiftUp(StepTimer &timer, uint8_t index){
+	uint32_t due = timer.dueTime[index];
+	uint8_t slot = timer.dueSlot[index];
+	while(index > 0){
+		uint8_t parent = (index - 1) >> 1;
+		if((int32_t)(due - timer.dueTime[parent]) >= 0) break;
+		timer.dueTime[index] = timer.dueTime[parent];
+		timer.dueSlot[index] = timer.dueSlot[parent];
+		VDW_Stepper::heapIndex[timer.dueSlot[index]] = index;
+		index = parent;
 	}
-	
+	timer.dueTime[index] = due;
+	timer.dueSlot[index] = slot;
+	VDW_Stepper::heapIndex[slot] = index;
+}
 
+void VDW_Stepper::heapSiftDown(StepTimer &timer, uint8_t index){
+	uint32_t due = timer.dueTime[index];
+	uint8_t slot = timer.dueSlot[index];
+	uint8_t size = timer.dueHeapSize;
+	while(true){
+		uint8_t child = (index << 1) + 1;
+		if(child >= size) break;
+		if(child + 1 < size && (int32_t)(timer.dueTime[child + 1] - timer.dueTime[child]) < 0) child++;
+		if((int32_t)(timer.dueTime[child] - due) >= 0) break;
+		timer.dueTime[index] = timer.dueTime[child];
+		timer.dueSlot[index] = timer.dueSlot[child];
+		VDW_Stepper::heapIndex[timer.dueSlot[index]] = index;
+		index = child;
+	}
+	timer.dueTime[index] = due;
+	timer.dueSlot[index] = slot;
+	VDW_Stepper::heapIndex[slot] = index;
+}
+
+void VDW_Stepper::heapRemove(StepTimer &timer, uint8_t index){
+	uint8_t slot = timer.dueSlot[index];
+	VDW_Stepper::heapIndex[slot] = HEAP_NONE;
+	VDW_Stepper::activeMap[slot >> 5] &= ~(1UL << (slot & 31));
+	uint8_t last = --timer.dueHeapSize;
+	if(index == last) return;
+	uint8_t moved = timer.dueSlot[last];
+	timer.dueTime[index] = timer.dueTime[last];
+	timer.dueSlot[index] = moved;
+	VDW_Stepper::heapIndex[moved] = index;
+	heapSiftUp(timer, index);
+	heapSiftDown(timer, VDW_Stepper::heapIndex[moved]);
+}
+
+// RUN ISR
+void VDW_Stepper::Run_ISR(StepTimer &timer){
+	// Running until the timer has nothing left to do
+	timer.enabled = true;
+
+#if defined(ISR_STATS)
 	// Record time ISR start
 	uint32_t timeISRStarted = CPU_Ticks();
+#endif
+	uint32_t now = schedulerClock(timer);
+
+	// End the step pulses of earlier passes
+	if(timer.edgeCount > 0) lowerStepEdges(timer, now);
+
+	// Schedule steppers started from thread context
+	while(timer.scheduleQueueHead != timer.scheduleQueueTail){
+		StepperPtr cStepper = timer.scheduleQueue[timer.scheduleQueueHead];
+		timer.scheduleQueueHead = (timer.scheduleQueueHead + 1) & (SCHEDULE_QUEUE_SIZE - 1);
+		if(cStepper == nullptr) continue; // detached
+		cStepper->_schedulePending = false;
+		uint8_t slot = cStepper->_slot;
 
-	// Get the list
-	StepperPtr cStepper = VDW_Stepper::head;
-
-	// Cycle through the list
-	int index = 0;
-	int nextDuration = 0x7FFFFFFF; // largest signed int
-	while(cStepper != nullptr){
-		if(cStepper->_stepTime > 0){ // Only operate on "active" steppers
-			// Subtract lastDuration from _stepTime
-			cStepper->_stepTime -= VDW_Stepper::lastDuration;
-
-			// Call a step if due
-			if(cStepper->_stepTime <= MIN_TIME_BETWEEN_RUN_ISR){
-				(cStepper->_direction) ? cStepper->_clockwise() : cStepper->_counterClockwise();
-				cStepper->_stepTime = cStepper->computeNewSpeed();
-				// Serial.printlnf("Step Stepper %d, next: %d",index, cStepper->_stepTime);
+		// Rescheduled with a command while moving, it keeps its step countdown so commands sent faster than
+		// its steps can not hold it back, the command applies from its next step. A faster speed does not
+		// wait out the rest of a slower step
+		uint8_t index = VDW_Stepper::heapIndex[slot];
+		if(cStepper->_stepTime > 0 && cStepper->_commandSeq != cStepper->_adoptedSeq){
+			cStepper->adoptCommand();
+			if(cStepper->_stepTime > 0 && index != HEAP_NONE){
+				if((int32_t)(timer.dueTime[index] - now) > cStepper->_stepInterval){
+					timer.dueTime[index] = now + cStepper->feedInterval(cStepper->_stepInterval);
+					heapSiftUp(timer, index);
+				}
+				continue;
 			}
+			cStepper->_stepTime = cStepper->_stepInterval;
+		}
+		if(cStepper->_stepTime <= 0){
+			// Stopped again, removed from the heap when it comes due
+			if(cStepper->_group) cStepper->_group->finish();
+			if(VDW_Stepper::heapIndex[slot] == HEAP_NONE) VDW_Stepper::activeMap[slot >> 5] &= ~(1UL << (slot & 31));
+			continue;
+		}
 
-			// Determine the next time Run_ISR should fire
-			if(cStepper->_stepTime < nextDuration) nextDuration = cStepper->_stepTime;
+		// Started from rest, its timing starts from now
+		uint32_t due = now + cStepper->feedInterval(cStepper->_stepTime);
+		if(index != HEAP_NONE){
+			timer.dueTime[index] = due;
+			heapSiftUp(timer, index);
+			heapSiftDown(timer, VDW_Stepper::heapIndex[slot]);
+		}else if(timer.dueHeapSize < MAX_STEPPERS){
+			timer.dueTime[timer.dueHeapSize] = due;
+			timer.dueSlot[timer.dueHeapSize] = slot;
+			heapSiftUp(timer, timer.dueHeapSize++);
+		}else{
+			cStepper->_stepTime = 0; // too many steppers running
+			if(cStepper->_group) cStepper->_group->finish();
+			VDW_Stepper::activeMap[slot >> 5] &= ~(1UL << (slot & 31));
+			ISR_Log(LOG_TOO_MANY_STEPPERS, timer.dueHeapSize, MAX_STEPPERS);
 		}
-		cStepper = cStepper->next;
-		index += 1;
 	}
 
-	// Record Time ISR End
-	uint32_t timeISREnded = CPU_Ticks();
+	// Collect every stepper that is due. The heap keeps them in a subtree at the top, so only the due
+	// entries and their children are visited
+	uint8_t dueIndex[MAX_STEPPERS];
+	uint8_t numDue = 0;
+	if(timer.dueHeapSize > 0 && (int32_t)(timer.dueTime[0] - now) <= MIN_TIME_BETWEEN_RUN_ISR){
+		dueIndex[numDue++] = 0;
+	}
+	for(uint8_t i=0; i<numDue; i++){
+		uint8_t child = (dueIndex[i] << 1) + 1;
+		for(uint8_t c=child; c<child+2 && c<timer.dueHeapSize; c++){
+			if((int32_t)(timer.dueTime[c] - now) <= MIN_TIME_BETWEEN_RUN_ISR) dueIndex[numDue++] = c;
+		}
+	}
+	StepperPtr due[MAX_STEPPERS];
+	for(uint8_t i=0; i<numDue; i++) due[i] = VDW_Stepper::slots[timer.dueSlot[dueIndex[i]]];
+
+	// Step them together, pin steppers are written with one write per port. While the falling edges of
+	// earlier passes fill the queue, steppers that would add one wait for the oldest to be lowered
+	bool edgesFull = (timer.edgeCount == STEP_EDGE_QUEUE_SIZE);
+	uint8_t deferred = 0; // steppers waiting for room for their edge
+	uint8_t turning[MAX_STEPPERS]; // slots of the steppers changing direction this pass
+	uint8_t numTurning = 0;
+#if defined(STEP_CAPTURE)
+	if(VDW_Stepper::capturing && numDue > 0) VDW_Stepper::captureTicks = CPU_Ticks();
+#endif
+	for(uint8_t i=0; i<numDue; i++){
+		StepperPtr cStepper = due[i];
+		if(cStepper->_stepTime <= 0) continue; // stopped from thread context
+
+		// Take the command posted since the last step, it may stop the motor
+		if(cStepper->_commandSeq != cStepper->_adoptedSeq){
+			cStepper->adoptCommand();
+			if(cStepper->_stepTime <= 0) continue;
+		}
 
-	// Remove ISR duration from _stepTime and nextDuration
-	uint32_t ISR_Duration = ((timeISREnded - timeISRStarted) / CPU_TICKS_PER_MICROSECOND()) + 1; // add 1 microsecond for time to 
-	cStepper = VDW_Stepper::head;
-	Serial.printlnf("\t\tISR Duration: %d", ISR_Duration);
-	while(cStepper != nullptr){
-		if(cStepper->_stepTime > 0 ) cStepper->_stepTime -= ISR_Duration;
-		cStepper = cStepper->next;
+		// The homing switch was hit, stop without waiting for homingState()
+		if(cStepper->_homeLatched && !cStepper->_homeStopping){
+			cStepper->homeStop();
+			if(cStepper->_stepTime <= 0) continue;
+		}
+		if(edgesFull && (cStepper->_stepPort || cStepper->_group)){
+			due[i] = nullptr; // still due, stepped by the pass that lowers the oldest edge
+			deferred += 1;
+			continue;
+		}
+
+		// Direction changed from thread context (a start or a Constant Speed reversal). Written with the
+		// falling edge of this pass, after the edges still waiting, one may hold the pin's last direction or the
+		// motor's last step. It steps once the direction is set up
+		if(cStepper->_stepPort && cStepper->_direction != cStepper->_dirState){
+			cStepper->queueDirection();
+			turning[numTurning++] = cStepper->_slot;
+			due[i] = nullptr;
+			continue;
+		}
+#if defined(ISR_STATS)
+		cStepper->recordStepError(now - timer.dueTime[VDW_Stepper::heapIndex[cStepper->_slot]]);
+#endif
+		cStepper->stepOutput();
+#if defined(STEP_CAPTURE)
+		if(VDW_Stepper::capturing) captureStep(cStepper->_slot, cStepper->_direction, now - timer.dueTime[VDW_Stepper::heapIndex[cStepper->_slot]]);
+#endif
+		cStepper->_position += (cStepper->_direction) ? 1 : -1;
+		cStepper->_motionCount = cStepper->_motionCount + 1;
+		if(cStepper->_group) cStepper->_group->stepMinorAxes();
 	}
-	nextDuration -= ISR_Duration;
 
-	// Setup for next Run_ISR
-	VDW_Stepper::lastDuration = nextDuration;
-	Serial.printlnf("\t\tNext ISR: %d", nextDuration/1000);
-	if(nextDuration < MIN_TIME_BETWEEN_RUN_ISR) nextDuration = MIN_TIME_BETWEEN_RUN_ISR;
-	if(nextDuration == 0x7FFFFFFF){
-		VDW_Stepper::ISR_Enabled = false;
-		VDW_Stepper::Step_Timer.end();
-	}else{
-		if(nextDuration <= 65535){
-			VDW_Stepper::Step_Timer.resetPeriod_SIT(nextDuration, uSec);
+	// The pins are lowered by the first pass after the pulse width, with any direction changes once they
+	// have been held. Rounded up, the scheduler time is truncated
+	uint32_t edgeDue = 0;
+	if(VDW_Stepper::stepPortsUsed){
+		raiseStepPins();
+		edgeDue = schedulerClock(timer) + ((VDW_Stepper::stepPulseWidth > VDW_Stepper::stepDirHold) ? VDW_Stepper::stepPulseWidth : VDW_Stepper::stepDirHold) + 1;
+	}
+	// Steppers changing direction step once it is set up. Steps are taken up to MIN_TIME_BETWEEN_RUN_ISR
+	// early but edges are never lowered early, so they wait that much longer
+	uint32_t setupDue = edgeDue + VDW_Stepper::stepDirSetup + MIN_TIME_BETWEEN_RUN_ISR;
+	for(uint8_t i=0; i<numTurning; i++){
+		uint8_t index = VDW_Stepper::heapIndex[turning[i]];
+		timer.dueTime[index] = setupDue;
+		heapSiftDown(timer, index);
+	}
+
+	// Compute the next step of each while the step pins are high
+	for(uint8_t i=0; i<numDue; i++){
+		StepperPtr cStepper = due[i];
+		if(cStepper == nullptr) continue; // waiting for its direction or for room for its edge
+
+		// Stopped from thread context
+		uint8_t index = VDW_Stepper::heapIndex[cStepper->_slot];
+		if(cStepper->_stepTime <= 0){
+			if(cStepper->_group) cStepper->_group->finish();
+			heapRemove(timer, index);
+			continue;
+		}
+
+		int32_t interval = cStepper->computeNewSpeed();
+		if(interval <= 0){
+			// Move complete, start the next queued move immediately
+			if(cStepper->_group) cStepper->_group->finish();
+			interval = cStepper->popSegment();
+		}
+		cStepper->_stepTime = interval;
+
+		// Reschedule from when the step was due so rounding does not accumulate
+		if(interval <= 0){
+			heapRemove(timer, index);
 		}else{
-			int timerVal = nextDuration/500; // convert uSec to hmSec
-			VDW_Stepper::Step_Timer.resetPeriod_SIT(timerVal, hmSec);
+			uint32_t due = timer.dueTime[index] + cStepper->feedInterval(interval);
+
+			// The next step is the other way, change direction with the falling edge
+			if(cStepper->_stepPort && cStepper->_direction != cStepper->_dirState){
+				cStepper->queueDirection();
+				if((int32_t)(due - setupDue) < 0) due = setupDue;
+			}
+			timer.dueTime[index] = due;
+			heapSiftDown(timer, index);
 		}
 	}
-	
-}
\ No newline at end of file
+	if(VDW_Stepper::stepPortsUsed) queueStepEdge(timer, edgeDue);
+	if(deferred) ISR_Log(LOG_EDGES_FULL, deferred, timer.edgeCount);
+
+#if defined(ISR_STATS)
+	// Record Time ISR End
+	uint32_t timeISREnded = CPU_Ticks();
+#endif
+
+	// Account for the ISR duration
+	schedulerClock(timer);
+#if defined(ISR_STATS)
+	recordISRStats(timeISRStarted, timeISREnded - timeISRStarted);
+#endif
+
+	// Setup for next Run_ISR
+	if(timer.dueHeapSize == 0 && timer.scheduleQueueHead == timer.scheduleQueueTail && timer.edgeCount == 0){
+		timer.enabled = false;
+		timer.timer.end();
+#if defined(ISR_STATS)
+		// Idle time does not count against invocationsPerSecond
+		bool idle = true;
+		for(uint8_t i=0; i<STEP_TIMERS; i++) idle = idle && !VDW_Stepper::stepTimers[i].enabled;
+		if(idle) VDW_Stepper::isrWindowCount = 0;
+#endif
+		return;
+	}
+	int nextDuration = (timer.dueHeapSize > 0) ? (int32_t)(timer.dueTime[0] - timer.schedulerTime) : MIN_TIMER_PERIOD;
+	if(nextDuration < 0 && !deferred) ISR_Log(LOG_BEHIND, -nextDuration, timer.dueHeapSize); // the pass overran a step
+	if(timer.edgeCount > 0){
+		int32_t edgeDuration = timer.edges[timer.edgeHead].due - timer.schedulerTime;
+		if(edgeDuration < nextDuration || deferred) nextDuration = edgeDuration;
+	}
+	if(nextDuration < MIN_TIMER_PERIOD) nextDuration = MIN_TIMER_PERIOD; // the hardware minimum, steps due sooner wait for it
+
+	// The timer always counts u-sec. Longer waits are chained, the pass at the end of a segment finds nothing
+	// due and arms the next one. Split the last two segments evenly so the final one is never short
+	if(nextDuration > MAX_TIMER_PERIOD) nextDuration = (nextDuration > 2 * MAX_TIMER_PERIOD) ? MAX_TIMER_PERIOD : nextDuration / 2;
+	timer.timer.resetPeriod_SIT(nextDuration, uSec);
+}
@@ -1,15 +1,11 @@
 #include "VDW_Stepper.h"
 
 VDW_Stepper::VDW_Stepper(){
-	if(VDW_Stepper::head == nullptr){
-		VDW_Stepper::head = this;
-	} else {
-		StepperPtr cStepper = VDW_Stepper::head;
-		while(cStepper->next != nullptr){
-			cStepper = cStepper->next;
-		}
-		cStepper->next = this;
-	}
+	attach();
+}
+
+VDW_Stepper::~VDW_Stepper(){
+	detach();
 }
 
 void VDW_Stepper::init(void (*clockwise)(), void(*counterClockwise)(), void(*enable)(), void(*disable)()){
@@ -19,12 +15,441 @@ void VDW_Stepper::init(void (*clockwise)(), void(*counterClockwise)(), void(*ena
   _disableStepper = disable;
 }
 
+bool VDW_Stepper::initPins(uint16_t stepPin, uint16_t dirPin, int16_t enablePin){
+  uint8_t stepIndex = VDW_Stepper::stepPortIndex(Pin_Port(stepPin));
+  uint8_t dirIndex = VDW_Stepper::stepPortIndex(Pin_Port(dirPin));
+  if(stepIndex >= MAX_STEP_PORTS || dirIndex >= MAX_STEP_PORTS) return false;
+
+  pinMode(stepPin, OUTPUT);
+  pinMode(dirPin, OUTPUT);
+  digitalWrite(stepPin, LOW);
+  digitalWrite(dirPin, LOW);
+  if(enablePin >= 0){
+    pinMode(enablePin, OUTPUT);
+    digitalWrite(enablePin, HIGH); // disabled until the first move
+    _enablePort = Pin_Port(enablePin);
+    _enableMask = Pin_Mask(enablePin);
+  }
+
+  _clockwise = nullptr;
+  _counterClockwise = nullptr;
+  _enableStepper = nullptr;
+  _disableStepper = nullptr;
+  _stepMask = Pin_Mask(stepPin);
+  _stepPortIndex = stepIndex;
+  _dirMask = Pin_Mask(dirPin);
+  _dirPortIndex = dirIndex;
+  _dirState = false;
+  _stepPort = Pin_Port(stepPin);
+  return true;
+}
+
+// Integer Square Root
+// Thread context only, used to seed ramps
+static uint32_t isqrt64(uint64_t value){
+  uint64_t result = 0;
+  uint64_t bit = 1ULL << 62;
+  while(bit > value) bit >>= 2;
+  while(bit != 0){
+    if(value >= result + bit){
+      value -= result + bit;
+      result = (result >> 1) + bit;
+    }else{
+      result >>= 1;
+    }
+    bit >>= 2;
+  }
+  return result;
+}
+
+// Ramp conversions (thread context only)
+static uint64_t intervalToQ(uint32_t interval){
+  return (1ULL << RAMP_Q_SHIFT) / ((uint64_t)interval * interval);
+}
+
+static uint32_t qToInterval(uint64_t q){
+  uint32_t maxInterval = milliStepsToUsecInterval(ULTIMATE_MIN_SPEED);
+  if(q == 0) return maxInterval;
+  uint32_t interval = isqrt64((1ULL << RAMP_Q_SHIFT) / q);
+  return (interval > maxInterval) ? maxInterval : interval;
+}
+
 int32_t VDW_Stepper::computeNewSpeed(){
-  if(_mode == ConstantSpeed || _tempMode == ConstantSpeed){
-    return _stepInterval;
+  if(_compiledPlaying){
+    return playCompiled();
+  }else if(_ramp.plan.deltaQ > 0){
+    return computeRampInterval(_ramp, _stepInterval, _direction);
+  }else{
+    // Stop when the target is reached
+    if(_hasTarget && _position == _target) return 0;
+    return _stepInterval + cruiseCarry(_ramp);
+  }
+}
+
+int32_t VDW_Stepper::computeRampInterval(RampState &ramp, volatile int32_t &interval, volatile bool &direction){
+  // Count the step. Indefinite ramps stop counting once they reach the cruise speed
+  uint32_t step = ramp.step;
+  if(ramp.plan.steps != RAMP_INDEFINITE || step <= ramp.plan.accelSteps) ramp.step = ++step;
+
+  // Use extra Newton iterations close to standstill where the speed changes quickly
+  uint8_t iterations = (ramp.q < RAMP_NEWTON_WARMUP * ramp.plan.deltaQ) ? 3 : 1;
+
+  if(ramp.plan.steps != RAMP_INDEFINITE){
+    // End of the ramp, start the next one if there is one
+    if(step >= ramp.plan.steps){
+      if(!ramp.hasNextPlan) return 0;
+      ramp.plan = ramp.nextPlan;
+      ramp.hasNextPlan = false;
+      direction = ramp.plan.direction;
+      ramp.step = 0;
+      ramp.sCurveIndex = 0;
+      ramp.q = ramp.plan.startQ;
+      ramp.carry = 0;
+      return interval = ramp.plan.firstInterval;
+    }
+
+    // Decelerate: speed^2 = 2 * a * steps remaining
+    uint32_t remaining = ramp.plan.steps - step;
+    if(remaining <= ramp.plan.decelSteps){
+      if(ramp.plan.sCurve) return interval = sCurveInterval(ramp, remaining);
+      ramp.q = remaining * ramp.plan.deltaQ;
+      return interval = rampNewton(ramp.q, interval, iterations);
+    }
+  }
+
+  // Change speed toward the cruise speed: speed^2 changes by 2 * a every step
+  if(step <= ramp.plan.accelSteps){
+    if(ramp.plan.sCurve) return interval = sCurveInterval(ramp, step);
+    ramp.q = (ramp.plan.accelerating) ? (ramp.q + ramp.plan.deltaQ) : (ramp.q - ramp.plan.deltaQ);
+    return interval = rampNewton(ramp.q, interval, iterations);
+  }
+
+  // Cruise
+  interval = ramp.plan.cruiseInterval;
+  return interval + cruiseCarry(ramp);
+}
+
+void VDW_Stepper::buildRamp(RampPlan &plan, bool direction, uint32_t steps, uint64_t startQ, int32_t cruiseSpeed, uint64_t deltaQ){
+  plan.direction = direction;
+  plan.sCurve = false;
+  plan.constantSpeed = false;
+  plan.deltaQ = deltaQ;
+  plan.steps = steps;
+  plan.startQ = startQ;
+  setCruiseRate(plan, cruiseSpeed);
+  uint32_t cruiseInterval = plan.cruiseInterval;
+
+  if(cruiseInterval == 0){
+    // Decelerate to a stop over the whole move
+    plan.accelerating = false;
+    plan.accelSteps = 0;
+    plan.decelSteps = steps;
+  }else{
+    uint64_t cruiseQ = intervalToQ(cruiseInterval);
+    plan.accelerating = (cruiseQ >= startQ);
+    plan.accelSteps = ((plan.accelerating) ? (cruiseQ - startQ) : (startQ - cruiseQ)) / deltaQ;
+    plan.decelSteps = (steps == RAMP_INDEFINITE) ? 0 : cruiseQ / deltaQ;
+
+    // Not enough room to reach the cruise speed, use a triangular profile
+    if(steps != RAMP_INDEFINITE && (uint64_t)plan.accelSteps + plan.decelSteps > steps){
+      if(plan.accelerating){
+        uint64_t peakQ = ((uint64_t)steps * deltaQ + startQ) / 2;
+        plan.accelSteps = (peakQ - startQ) / deltaQ;
+      }else{
+        plan.accelSteps = 0;
+      }
+      plan.decelSteps = steps - plan.accelSteps;
+    }
+  }
+
+  // Time until the first step. From rest it is the exact time to travel one step, sqrt(2/a)
+  if(startQ == 0){
+    uint32_t restInterval = qToInterval(deltaQ >> 2);
+    plan.firstInterval = (cruiseInterval > restInterval) ? cruiseInterval : restInterval;
+  }else{
+    plan.firstInterval = qToInterval(startQ);
+  }
+}
+
+void VDW_Stepper::planRamp(MotionCommand &motion, bool hasTarget){
+  int32_t speed = activeSpeed();
+  uint64_t deltaQ = accelerationToDeltaQ(activeAcceleration());
+  bool sCurve = (activeMode() == SCurve && _jerk > 0);
+
+  // Current motion
+  bool moving = (motion.stepInterval > 0);
+  uint64_t startQ = (moving) ? intervalToQ(motion.stepInterval) : 0;
+  uint32_t stopSteps = startQ / deltaQ;
+  if(moving && stopSteps == 0) stopSteps = 1;
+
+  // Requested motion
+  bool direction;
+  uint32_t steps;
+  if(hasTarget){
+    int32_t distance = motion.target - motion.position;
+    direction = (distance > 0);
+    steps = abs(distance);
+  }else{
+    direction = (speed > 0);
+    steps = (speed) ? RAMP_INDEFINITE : stopSteps;
+    if(speed == 0) direction = motion.direction;
+  }
+
+  motion.ramp.hasNextPlan = false;
+  if(moving && (direction != motion.direction || (hasTarget && stopSteps > steps) || (sCurve && (hasTarget || speed)))){
+    // Wrong direction or not enough room to stop, stop first then move from rest
+    // S-curves are always planned from rest
+    buildRamp(motion.ramp.plan, motion.direction, stopSteps, startQ, 0, deltaQ);
+    int32_t stopPosition = motion.position + ((motion.direction) ? (int32_t)stopSteps : -(int32_t)stopSteps);
+    if(hasTarget && motion.target != stopPosition){
+      if(sCurve) buildSCurve(motion.ramp.nextPlan, (motion.target > stopPosition), abs(motion.target - stopPosition), speed);
+      else buildRamp(motion.ramp.nextPlan, (motion.target > stopPosition), abs(motion.target - stopPosition), 0, speed, deltaQ);
+      motion.ramp.hasNextPlan = true;
+    }else if(!hasTarget && speed){
+      if(sCurve) buildSCurve(motion.ramp.nextPlan, direction, RAMP_INDEFINITE, speed);
+      else buildRamp(motion.ramp.nextPlan, direction, RAMP_INDEFINITE, 0, speed, deltaQ);
+      motion.ramp.hasNextPlan = true;
+    }
+  }else if(sCurve && !moving){
+    buildSCurve(motion.ramp.plan, direction, steps, speed);
+  }else{
+    buildRamp(motion.ramp.plan, direction, steps, startQ, speed, deltaQ);
+  }
+  motion.ramp.q = startQ;
+  motion.ramp.step = 0;
+  motion.ramp.carry = 0;
+  motion.ramp.sCurveIndex = 0;
+}
+
+void VDW_Stepper::startMotion(bool hasTarget, int32_t target){
+  cancelCompiled();
+  MotionCommand &motion = composeCommand();
+  motion.hasTarget = hasTarget;
+  if(hasTarget) motion.target = target;
+
+  if(activeMode() != ConstantSpeed && activeAcceleration() > 0){
+    // ACCELERATIONS AND SCURVE MODES
+    // A moving motor keeps its current step countdown, the new ramp starts at the next step
+    bool moving = (motion.stepInterval > 0);
+    planRamp(motion, hasTarget);
+    if(!moving){
+      if(motion.ramp.plan.steps == 0) return;
+      motion.direction = motion.ramp.plan.direction;
+      motion.stepInterval = motion.ramp.plan.firstInterval;
+    }
+    postCommand(!moving);
+    return;
+  }
+
+  // CONSTANT SPEED MODE
+  // Accelerations and SCurve modes without an acceleration also run at constant speed
+  // Get the speed
+  int32_t newSpeed = activeSpeed();
+
+  // A running motor blends to a new speed in the same direction with the acceleration, if one is set
+  if(!hasTarget && motion.stepInterval > 0 && newSpeed != 0 && (newSpeed > 0) == motion.direction && activeAcceleration() > 0){
+    planRamp(motion, false);
+    motion.ramp.plan.constantSpeed = true;
+    postCommand(false);
+    return;
+  }
+  motion.ramp.plan.deltaQ = 0;
+  motion.ramp.hasNextPlan = false;
+
+  // Set the direction
+  if(hasTarget){
+    if(motion.target == motion.position) newSpeed = 0;
+    motion.direction = (motion.target > motion.position) ? 1 : 0;
   }else{
-    return 0;
+    motion.direction = (newSpeed > 0) ? 1 : 0;
+  }
+
+  // Calculate the ISR interval, Run_ISR() carries the truncated fraction
+  setCruiseRate(motion.ramp.plan, newSpeed);
+  motion.ramp.carry = 0;
+  motion.stepInterval = motion.ramp.plan.cruiseInterval;
+  postCommand(true);
+}
+
+MotionCommand& VDW_Stepper::composeCommand(){
+  uint8_t seq = _commandSeq;
+  MotionCommand &motion = _commands[(seq + 1) & 1];
+  if(seq != _adoptedSeq){
+    // Build on the command Run_ISR() has not adopted yet, Run_ISR() only reads it
+    motion = _commands[seq & 1];
+    return motion;
+  }
+
+  // Copy the live motion, again if Run_ISR() stepped the motor meanwhile
+  uint8_t count;
+  do{
+    count = _motionCount;
+    MemoryBarrier();
+    motion.ramp = _ramp;
+    motion.stepInterval = (_stepTime > 0) ? _stepInterval : 0;
+    motion.target = _target;
+    motion.position = _position;
+    motion.direction = _direction;
+    motion.hasTarget = _hasTarget;
+    MemoryBarrier();
+  }while(count != _motionCount);
+  return motion;
+}
+
+void VDW_Stepper::postCommand(bool reschedule){
+  MemoryBarrier();
+  _commandSeq = _commandSeq + 1;
+
+  // Run_ISR() adopts it before the next step, or now if it is woken to reschedule the motor. Run_ISR() only
+  // stops a motor before it steps, so a motor that stopped while the command was planned is stopped here
+  if(_stepTime > 0){
+    if(reschedule) startStepping();
+    return;
   }
+
+  // A stopped motor is not read by Run_ISR(), start it with the command
+  adoptCommand();
+  if(_stepInterval <= 0) return;
+  if(_compiled && _hasTarget && _ramp.plan.deltaQ > 0 && !_ramp.plan.constantSpeed) startCompiled();
+  _stepTime = _stepInterval;
+  startStepping();
+}
+
+void VDW_Stepper::adoptCommand(){
+  uint8_t seq = _commandSeq;
+  const MotionCommand &motion = _commands[seq & 1];
+  _ramp = motion.ramp;
+  _compiledPlaying = false;
+
+  // Steps taken since the command was planned are part of the new ramp
+  uint32_t taken = abs(_position - motion.position);
+  if(taken > 0 && motion.ramp.plan.deltaQ > 0) _ramp.step = _ramp.step + taken;
+
+  _stepInterval = motion.stepInterval;
+  _direction = motion.direction;
+  _hasTarget = motion.hasTarget;
+  _target = (motion.hasTarget) ? motion.target : (int32_t)_position;
+  if(motion.stepInterval <= 0) _stepTime = 0;
+  _adoptedSeq = seq;
+  _motionCount = _motionCount + 1;
+}
+
+void VDW_Stepper::startStepping(){
+  // Steppers without a registry slot can not be scheduled
+  if(_slot == NO_SLOT){
+    _stepTime = 0;
+    return;
+  }
+
+  // Enable the stepper
+  enable();
+
+  // Pick a timer if the stepper is idle. Run_ISR() never touches a stepper that is not in its heap or queue,
+  // and only ever takes one out, so the stepper stays idle until requestSchedule()
+  if(VDW_Stepper::heapIndex[_slot] == HEAP_NONE && !_schedulePending) _timer = chooseTimer();
+  StepTimer &timer = VDW_Stepper::stepTimers[_timer];
+
+  // Hand the stepper to Run_ISR()
+  requestSchedule();
+
+  // Restart the ISR if required
+  if(timer.enabled == false){
+    VDW_Stepper::ticksPerMicrosecond.set(CPU_TICKS_PER_MICROSECOND()); // Run_ISR() divides ticks by multiplying
+    if(!timer.timer.begin(VDW_Stepper::timerISR[_timer], MIN_TIMER_PERIOD, uSec) && _timer != 0){ // Run_ISR() arms the real period
+      // The hardware timer is in use, take the stepper back (the queue has no consumer) and use another timer
+      timer.unavailable = true;
+      timer.scheduleQueueTail = (timer.scheduleQueueTail - 1) & (SCHEDULE_QUEUE_SIZE - 1);
+      _schedulePending = false;
+      startStepping();
+    }
+  }
+  else // Run_ISR() reads the clock so waking it early is safe, schedule the stepper now rather than at the next step due
+    timer.timer.resetPeriod_SIT(MIN_TIMER_PERIOD, uSec);
+}
+
+bool VDW_Stepper::queueMove(int32_t position, Mode mode, int32_t speed, uint32_t acceleration){
+  uint8_t tail = _queueTail;
+  uint8_t next = (tail + 1) & (MOVE_QUEUE_SIZE - 1);
+  if(next == _queueHead) return false; // full
+
+  // Settings of the move
+  if(mode == NoChange) mode = _mode;
+  if(speed == 0) speed = _speed;
+  if(acceleration == 0) acceleration = _acceleration;
+  if(_safeSpeed > 0) speed = Constrain(speed, -_safeSpeed, _safeSpeed);
+
+  // The move starts where the last queued move (or the current move) ends
+  bool empty = (((_flushQueue) ? _flushTo : _queueHead) == tail);
+  const MotionCommand &motion = composeCommand();
+  int32_t start = (!empty) ? _queueEnd : ((motion.stepInterval > 0) ? motion.target : motion.position);
+  if(position == start || speed == 0) return true; // nothing to do
+
+  // Plan the move
+  MoveSegment &segment = _queue[tail];
+  bool direction = (position > start);
+  uint32_t steps = abs(position - start);
+  if(mode != ConstantSpeed && acceleration > 0){
+    buildRamp(segment.plan, direction, steps, 0, speed, accelerationToDeltaQ(acceleration));
+  }else{
+    segment.plan = RampPlan();
+    segment.plan.direction = direction;
+    segment.plan.steps = steps;
+    setCruiseRate(segment.plan, speed);
+    segment.plan.firstInterval = segment.plan.cruiseInterval;
+  }
+  segment.target = position;
+  _queueEnd = position;
+
+  // Publish the segment
+  MemoryBarrier();
+  _queueTail = next;
+
+  startQueue();
+  return true;
+}
+
+uint8_t VDW_Stepper::queueAvailable(){
+  return (_queueHead - _queueTail - 1) & (MOVE_QUEUE_SIZE - 1);
+}
+
+void VDW_Stepper::clearQueue(){
+  _flushTo = _queueTail;
+  MemoryBarrier();
+  _flushQueue = true;
+  startQueue(); // drops the segments now if idle
+}
+
+void VDW_Stepper::startQueue(){
+  // Run_ISR() starts the next segment of a running stepper
+  if(_stepTime > 0 || _holdQueue) return;
+  int32_t interval = popSegment();
+  if(interval <= 0) return;
+  _stepTime = interval;
+  startStepping();
+}
+
+int32_t VDW_Stepper::popSegment(){
+  if(_flushQueue){
+    _queueHead = _flushTo;
+    _flushQueue = false;
+  }
+  uint8_t head = _queueHead;
+  if(_holdQueue || head == _queueTail) return 0;
+
+  MemoryBarrier();
+  const MoveSegment &segment = _queue[head];
+  _ramp.plan = segment.plan;
+  _ramp.hasNextPlan = false;
+  _ramp.step = 0;
+  _ramp.q = 0;
+  _ramp.carry = 0;
+  _target = segment.target;
+  _hasTarget = true;
+  _direction = segment.plan.direction;
+  _stepInterval = segment.plan.firstInterval;
+  MemoryBarrier();
+  _queueHead = (head + 1) & (MOVE_QUEUE_SIZE - 1);
+  return _stepInterval;
 }
 
 void VDW_Stepper::clearTemps(){
@@ -34,66 +459,198 @@ void VDW_Stepper::clearTemps(){
 }
 
 void VDW_Stepper::run(Mode mode, int32_t speed, uint32_t acceleration){
-  // Return if nothing is changing
-  // if _stepTime > 0 and no settings are passed
-  // if _stepTime > 0 and settings are same as current
-  if(_stepTime > 0){
-    if(mode==NoChange || mode==_mode
-      && speed==0 || speed==_speed
-      && acceleration==0 || acceleration==_acceleration){
+  // Constrain speed if Safe Speed is set
+  if(_safeSpeed > 0) speed = Constrain(speed, -_safeSpeed, _safeSpeed);
+
+  // Return if nothing is changing: already running indefinitely with the same settings
+  const MotionCommand &motion = composeCommand();
+  if(motion.stepInterval > 0 && !motion.hasTarget){
+    if(((mode == NoChange) ? _mode : mode) == activeMode()
+      && ((speed == 0) ? _speed : speed) == activeSpeed()
+      && ((acceleration == 0) ? _acceleration : acceleration) == activeAcceleration()){
         return;
       }
   }
 
-  // Constrain speed if Safe Speed is set
-  if(_safeSpeed > 0) speed = Constrain(speed, -_safeSpeed, _safeSpeed);
-  
   // Assign any temporary settings
   _tempMode = mode; // will assign no change if nothing is passed
   _tempSpeed = speed; // will assign 0 if nothing is passed
   _tempAcceleration = acceleration; // will assign 0 if nothing is passed
 
   // Set the motor to run indefinitely
-  _hasTarget = false;
-
-  // CONSTANT SPEED MODE
-  if(_tempMode == ConstantSpeed 
-    || (_mode == ConstantSpeed && _tempMode != Accelerations)){
-    
-    // Get the speed
-    int32_t newSpeed = (_tempSpeed) ? (_tempSpeed) : (_speed);
+  startMotion(false);
+}
 
-    // Set the direction
-    _direction = (newSpeed > 0) ? 1 : 0;
+void VDW_Stepper::moveAbsolute(int32_t position, Mode mode, int32_t speed, uint32_t acceleration){
+  // Constrain speed if Safe Speed is set
+  if(_safeSpeed > 0) speed = Constrain(speed, -_safeSpeed, _safeSpeed);
 
-    // Calculate the ISR interval
-    if(newSpeed == 0)  _stepInterval = 0;
-    else _stepInterval = milliStepsToUsecInterval((_tempSpeed) ? (_tempSpeed) : (_speed));
-    _stepTime = _stepInterval;
+  // Assign any temporary settings
+  _tempMode = mode;
+  _tempSpeed = speed;
+  _tempAcceleration = acceleration;
 
-    // Enable the stepper
-    if(_enableStepper) _enableStepper();
-  }
+  // Set the motor to run to the target
+  startMotion(true, position);
+}
 
-  // Restart the ISR if required
-  if(VDW_Stepper::ISR_Enabled == false) 
-    VDW_Stepper::Step_Timer.begin(VDW_Stepper::Run_ISR, 65535, hmSec); // duration does not matter, Run_ISR executes immediately which will change duration
+void VDW_Stepper::moveRelative(int32_t distance, Mode mode, int32_t speed, uint32_t acceleration){
+  moveAbsolute(_position + distance, mode, speed, acceleration);
 }
 
 void VDW_Stepper::stop(){
-  if(_mode == ConstantSpeed || _tempMode == ConstantSpeed){ 
-    _stepInterval = 0; // Stop immediately
-    _target = 0; // Set target position to 0
-    clearTemps(); // reset any temporary settings
-  }else{
-    return;
+  cancelCompiled();
+  MotionCommand &motion = composeCommand();
+  if(motion.ramp.plan.deltaQ == 0 || motion.ramp.plan.constantSpeed){
+    motion.stepInterval = 0; // Stop immediately
+    motion.hasTarget = false; // Set target position to where the motor stops
+    postCommand(true);
+  }else if(motion.stepInterval > 0){
+    planStop(motion); // Decelerate to a stop, sets the target position to where the motor stops
+    postCommand(false);
   }
+  _resumeToTarget = false;
+  _holdQueue = false;
+  clearQueue();
+  clearTemps(); // reset any temporary settings
 }
 
 void VDW_Stepper::pause(){
-  if(_mode == ConstantSpeed || _tempMode == ConstantSpeed){ // Stop immediately if Constant Speed
+  cancelCompiled();
+  MotionCommand &motion = composeCommand();
+
+  // Remember where the motor was going
+  _tempTarget = motion.target;
+  _resumeToTarget = motion.hasTarget;
+  _holdQueue = true;
+
+  if(motion.ramp.plan.deltaQ == 0 || motion.ramp.plan.constantSpeed){ // Stop immediately if Constant Speed
+    motion.stepInterval = 0;
+    postCommand(true);
+  }else if(motion.stepInterval > 0){
+    planStop(motion);
+    postCommand(false);
+  }
+}
+
+void VDW_Stepper::resume(){
+  if(!_holdQueue) return;
+  _holdQueue = false;
+  startMotion(_resumeToTarget, _tempTarget);
+  startQueue(); // the paused move may already be complete
+}
+
+void VDW_Stepper::planStop(MotionCommand &motion){
+  RampState &ramp = motion.ramp;
+
+  // S-curves stop by playing the table backwards from the current position along it
+  if(ramp.plan.sCurve && !ramp.hasNextPlan){
+    uint32_t step = ramp.step;
+    uint32_t position = ramp.plan.accelSteps;
+    if(ramp.plan.steps != RAMP_INDEFINITE && ramp.plan.steps - step <= ramp.plan.decelSteps) position = ramp.plan.steps - step;
+    else if(step < ramp.plan.accelSteps) position = step;
+    if(position > 0){
+      RampPlan plan = ramp.plan;
+      plan.steps = position;
+      plan.accelSteps = 0;
+      plan.decelSteps = position;
+      ramp.plan = plan;
+      ramp.step = 0;
+      motion.target = motion.position + ((motion.direction) ? (int32_t)position : -(int32_t)position);
+      motion.hasTarget = true;
+      return;
+    }
+  }
+
+  uint64_t deltaQ = ramp.plan.deltaQ;
+  uint64_t startQ = intervalToQ(motion.stepInterval);
+  uint32_t stopSteps = startQ / deltaQ;
+  if(stopSteps == 0) stopSteps = 1;
+
+  buildRamp(ramp.plan, motion.direction, stopSteps, startQ, 0, deltaQ);
+  ramp.hasNextPlan = false;
+  ramp.q = startQ;
+  ramp.step = 0;
+
+  motion.target = motion.position + ((motion.direction) ? (int32_t)stopSteps : -(int32_t)stopSteps);
+  motion.hasTarget = true;
+}
+
+void VDW_Stepper::eStop(){
+  _adoptedSeq = _commandSeq; // drop a command Run_ISR() has not adopted
+  _stepTime = 0;
+  _stepInterval = 0;
+  _compiledPlaying = false;
+  _ramp.hasNextPlan = false;
+  _hasTarget = false;
+  _resumeToTarget = false;
+  _holdQueue = false;
+  clearQueue();
+  finishGroup();
+  _encoderOffset -= _position;
+  _position = 0;
+  _target = 0;
+  clearTemps();
+}
+
+void VDW_Stepper::disable(){
+  // Stop immediately, a disabled motor can not decelerate
+  _adoptedSeq = _commandSeq;
+  if(_stepTime > 0){
+    _stepTime = 0;
     _stepInterval = 0;
-  }else{
-    return;
+    _target = _position;
   }
-}
\ No newline at end of file
+  finishGroup();
+  _compiledPlaying = false;
+  _holdQueue = false;
+  clearQueue();
+  if(_disableStepper) _disableStepper();
+  if(_enablePort) Port_Write(_enablePort, _enableMask, 0);
+}
+
+void VDW_Stepper::enable(){
+  if(_enableStepper) _enableStepper();
+  if(_enablePort) Port_Write(_enablePort, 0, _enableMask);
+}
+
+// SETTERS
+void VDW_Stepper::setMaxSpeed(int32_t speed){
+  _safeSpeed = abs(speed);
+}
+
+void VDW_Stepper::setAcceleration(uint32_t acceleration){
+  _acceleration = acceleration;
+}
+
+void VDW_Stepper::setSpeed(int32_t speed){
+  if(_safeSpeed > 0) speed = Constrain(speed, -_safeSpeed, _safeSpeed);
+  _speed = speed;
+}
+
+void VDW_Stepper::setMode(Mode mode){
+  if(mode != NoChange) _mode = mode;
+}
+
+void VDW_Stepper::setJerk(uint32_t jerk){
+  _jerk = jerk;
+}
+
+void VDW_Stepper::setCurrentPosition(int32_t position){
+  _encoderOffset += position - _position;
+  _position = position;
+  _target = position;
+}
+
+// GETTERS
+int32_t VDW_Stepper::targetPosition(){
+  uint8_t seq = _commandSeq;
+  if(seq == _adoptedSeq) return _target;
+  return (_commands[seq & 1].hasTarget) ? _commands[seq & 1].target : (int32_t)_position;
+}
+
+int32_t VDW_Stepper::getCurrentSpeed(){
+  if(_stepTime <= 0 || _stepInterval <= 0) return 0;
+  int32_t speed = (int64_t)(1000000000/_stepInterval) * VDW_Stepper::feedOverride / 100;
+  return (_direction) ? speed : -speed;
+}
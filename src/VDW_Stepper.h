@@ -1,43 +1,387 @@
 #ifndef VDW_STEPPER_H
 #define VDW_STEPPER_H
 
-// Hardware/Platform Abstractions
-#define PARTICLE
-#if defined(PARTICLE)
-  #include "Particle.h"
-  #include "SparkIntervalTimer.h"
-  #define CPU_Ticks() (System.ticks())
-  #define CPU_TICKS_PER_MICROSECOND() (System.ticksPerMicrosecond())
-  #define Constrain(value, min, max) (constrain(value, min, max))
+// Hardware/Platform Abstractions (Particle or the Linux simulator)
+#include "VDW_Stepper-HAL.h"
+
+// ISR Log
+// ISR_LOG: Run_ISR() records exceptional events (overruns, a full step edge queue, scheduler overflow) into a
+// small lock-free ring buffer that is printed from loop() with drainLog(). Normal passes log nothing. Comment out
+// to remove the log entirely.
+#define ISR_LOG
+#define ISR_LOG_SIZE 32 // entries in the log, must be a power of 2
+#if defined(ISR_LOG)
+  #define ISR_Log(event, arg1, arg2) (VDW_Stepper::logEvent((event), (arg1), (arg2)))
+#else
+  #define ISR_Log(event, arg1, arg2) ((void)0)
 #endif
 
-#define MIN_TIME_BETWEEN_RUN_ISR 2
+// ISR Statistics
+// ISR_STATS: Run_ISR() keeps counters of its own duration and step timing, read with getISRStats() and
+// getStepStats(). Comment out to remove the counters from the interrupt.
+#define ISR_STATS
+#define ISR_STATS_BUCKETS 16 // log2 histogram buckets of ISR duration, the last bucket counts anything longer
+#define ISR_STATS_DEADLINE_TOLERANCE 10 // u-sec a step can be late before it counts as a missed deadline
+
+// Step Capture
+// STEP_CAPTURE: Run_ISR() records every step into a RAM ring while startCapture() is on, printed from loop()
+// with dumpCapture() and analyzed on a PC with examples/capture_analyzer/capture_analyzer.cpp. Uncomment to build
+// the capture in, it costs a CPU_Ticks() read per pass and a few bytes per step while capturing.
+//#define STEP_CAPTURE
+#define STEP_CAPTURE_SIZE 8192 // bytes in the capture ring, must be a power of 2
+#define STEP_CAPTURE_LINE 32 // ring bytes printed per line by dumpCapture()
+
+#define MIN_TIMER_PERIOD 10 // shortest timer period (u-sec), SparkIntervalTimer's begin() refuses less
+#define MIN_TIME_BETWEEN_RUN_ISR (MIN_TIMER_PERIOD / 2) // steps due this soon (u-sec) are taken now rather than a period late
+#define MAX_TIMER_PERIOD 65535 // longest timer period (u-sec), longer waits are chained from segments of at most this
+#define STEP_TIMERS 3 // hardware timers (SparkIntervalTimer slots) the steppers are spread across, 1 to 5
+#define STEP_TIMER_MAX_RATE 40000000 // expected mSteps/sec of a timer before starting steppers spill to the next one
+#define MAX_STEPPERS 64 // maximum number of steppers running at the same time on each timer
+#define MAX_STEPPER_SLOTS 64 // maximum number of attached steppers, the size of the registry, a multiple of 32
+#define SLOT_WORDS (MAX_STEPPER_SLOTS / 32) // words in the registry bitmaps
+#define NO_SLOT 0xFF // slot of a detached stepper, it never runs
+#define HEAP_NONE 0xFF // heapIndex of a stepper that is not in a heap
+#define SCHEDULE_QUEUE_SIZE 128 // steppers waiting to be scheduled by Run_ISR(), power of 2 greater than MAX_STEPPERS
 #define ULTIMATE_MIN_SPEED 31 // milli-steps/sec
 #define ULTIMATE_MAX_SPEED 100000000 // milli-steps/sec
 
+// Ramp (Accelerations mode) fixed-point settings
+// The ramp tracks speed squared as Q, scaled so that Q * interval^2 == 2^RAMP_Q_SHIFT (interval in u-sec)
+#define RAMP_Q_SHIFT 61
+#define RAMP_NEWTON_WARMUP 16 // steps near standstill that use extra Newton iterations
+#define RAMP_INDEFINITE 0xFFFFFFFF // number of steps in a ramp with no target (run)
+#define MOVE_QUEUE_SIZE 8 // queued moves per stepper, must be a power of 2
+#define COMPILED_CHUNK_SIZE 128 // entries in each of the two chunks of a CompiledBuffer
+#define SCURVE_TABLE_SIZE 32 // entries in the S-curve interval table
+#define SCURVE_TABLES 8 // S-curve tables shared by all steppers, one per speed, acceleration and jerk in use, at most 32
+#define SCURVE_SLOPE_SHIFT 12 // fixed-point fraction bits of SCurveEntry::slope
+
+// Feed Override (setFeedOverride())
+#define MIN_FEED_OVERRIDE 10 // percent
+#define MAX_FEED_OVERRIDE 500 // percent
+#define FEED_SCALE_SHIFT 16 // fixed-point fraction bits of the interval scale
+
+// Step Pins (initPins())
+#define MAX_STEP_PORTS 8 // GPIO ports that can hold step and direction pins
+#define STEP_PULSE_WIDTH 2 // default minimum step pulse high time (u-sec), see setStepTiming()
+#define STEP_DIR_SETUP 1 // default minimum time from a direction change to the next step (u-sec)
+#define STEP_DIR_HOLD 1 // default minimum time from a step to a direction change (u-sec)
+#define STEP_EDGE_QUEUE_SIZE 4 // falling edges each timer can have waiting, must be a power of 2
+
+// Reciprocal Divide
+// numerator / divisor without a divide instruction: a table-seeded Newton-Raphson reciprocal (Q63) and a
+// remainder correction, so the result is exact. Returns 0 if divisor is 0.
+uint32_t reciprocalDivide(uint32_t numerator, uint32_t divisor);
+
+// Reciprocal
+// Repeated division by the same divisor. set() does the one real division (thread context), divide()
+// is a multiply and at most one correction, safe to call from Run_ISR().
+struct Reciprocal{
+  uint32_t divisor = 0;
+  uint32_t multiplier = 0; // floor(2^32 / divisor), 2^32 - 1 for divisor 1
+
+  void set(uint32_t newDivisor){
+    divisor = newDivisor;
+    multiplier = (newDivisor > 1) ? (uint32_t)((1ULL << 32) / newDivisor) : 0xFFFFFFFF;
+  }
+
+  // Divide
+  // \param[u32] numerator
+  // \param[u32&] remainder - returns numerator % divisor
+  // \return[u32] numerator / divisor
+  uint32_t divide(uint32_t numerator, uint32_t &remainder) const {
+    uint32_t quotient = ((uint64_t)numerator * multiplier) >> 32; // floor(numerator / divisor) or one less
+    remainder = numerator - quotient * divisor;
+    if(remainder >= divisor){
+      quotient++;
+      remainder -= divisor;
+    }
+    return quotient;
+  }
+};
+
+// Milli-Steps to u-sec Interval
+// \param[i32] milliSteps - the speed (mSteps/sec), negative == CCW
+// \return[u32] the step interval (u-sec), 0 if milliSteps is 0
+// Parts with a divide instruction (Cortex-M3/M4, ie the Photon) divide directly, it is faster than the
+// reciprocal. See examples/reciprocal for a benchmark.
 inline uint32_t milliStepsToUsecInterval(int32_t milliSteps){
-  return abs(1000000000/milliSteps);
+  uint32_t divisor = (milliSteps < 0) ? -(uint32_t)milliSteps : milliSteps;
+#if defined(__ARM_FEATURE_IDIV)
+  return (divisor) ? 1000000000 / divisor : 0;
+#else
+  return reciprocalDivide(1000000000, divisor);
+#endif
+}
+
+// Acceleration To Delta Q
+// Change in Q per step for an acceleration: 2 * a * 2^RAMP_Q_SHIFT, with a in steps/usec^2.
+// 2^62 / 10^15 = 4611.686018. Thread context only.
+// \param[u32] acceleration - the acceleration (mSteps/sec^2)
+inline uint64_t accelerationToDeltaQ(uint32_t acceleration){
+  return (uint64_t)acceleration * 4611 + ((uint64_t)acceleration * 686018) / 1000000;
+}
+
+// Ramp Newton
+// Refines a step interval toward 1/sqrt(Q) with Newton iterations for the inverse square root:
+//   c' = c * (3 - Q*c^2) / 2
+// Multiplies and shifts only, so it is safe to call from Run_ISR(). The previous step interval
+// is an excellent seed, 1 iteration is enough except close to standstill.
+// \param[u64] q - the speed squared (see RAMP_Q_SHIFT)
+// \param[u32] interval - the seed interval (u-sec). Must be less than 2.8x the result
+// \param[u8] iterations - the number of Newton iterations to run
+// \return[u32] the refined interval (u-sec)
+inline uint32_t rampNewton(uint64_t q, uint32_t interval, uint8_t iterations){
+  while(iterations--){
+    uint64_t qc2 = ((q * interval) * interval) >> (RAMP_Q_SHIFT - 30); // Q*c^2 in Q30
+    if(qc2 >= (3ULL << 30)){ // seed too slow for Newton to converge, halve and try again
+      interval >>= 1;
+      continue;
+    }
+    interval = ((uint64_t)interval * ((3ULL << 30) - qc2)) >> 31;
+  }
+  return interval;
 }
 
 class VDW_Stepper;
+class StepperGroup;
 typedef VDW_Stepper* StepperPtr;
 
 enum Mode{
   NoChange,
   ConstantSpeed,
   Accelerations,
+  SCurve,
+};
+
+// Encoder States
+enum EncoderState{
+  ENCODER_NONE, // no encoder set
+  ENCODER_OK, // the motor is within the following window of its position
+  ENCODER_FOLLOWING, // the motor is further than the following window from its position
+  ENCODER_STALLED, // the error reached the stall error and the motor was stopped, until clearStall()
+};
+
+// Homing States
+enum HomingState{
+  HOMING_IDLE, // home() has not been called
+  HOMING_SEEKING, // running toward the switch
+  HOMING_TOUCHING, // the switch was hit, backing off and touching it again slowly
+  HOMING_DONE, // the switch was latched and the position set
+  HOMING_FAILED, // the motor stopped without hitting the switch (or the switch was already hit when home() was called)
+};
+
+// ISR Log Events
+enum LogEvent{
+  LOG_BEHIND, // arg1: how late the next step already is when the pass ends (u-sec), arg2: steppers running
+  LOG_EDGES_FULL, // arg1: steppers deferred to a later pass, arg2: step edges queued
+  LOG_TOO_MANY_STEPPERS, // arg1: steppers scheduled, arg2: MAX_STEPPERS
+};
+
+// ISR Log Entry
+struct LogEntry{
+  uint32_t timestamp; // CPU_Ticks() when the event was logged
+  uint8_t event; // LogEvent
+  int32_t arg1;
+  int32_t arg2;
+};
+
+// ISR Statistics
+// Cost and accuracy of Run_ISR() since resetISRStats()
+struct ISRStats{
+  uint32_t invocations = 0; // Run_ISR() calls
+  uint32_t minTicks = 0; // shortest Run_ISR() (CPU ticks)
+  uint32_t maxTicks = 0; // longest Run_ISR() (CPU ticks)
+  uint32_t meanTicks = 0; // average Run_ISR() (CPU ticks)
+  uint32_t histogram[ISR_STATS_BUCKETS] = {}; // bucket n counts durations of 2^(n-1) to 2^n - 1 ticks
+  uint32_t missedDeadlines = 0; // steps taken more than ISR_STATS_DEADLINE_TOLERANCE late
+  uint32_t invocationsPerSecond = 0; // Run_ISR() calls per second of every timer together, over the last second a timer was running
+};
+
+// Step Statistics
+// Step timing error of one stepper, compared with the ideal schedule, since resetStepStats()
+struct StepStats{
+  uint32_t steps = 0; // steps taken
+  int32_t minError = 0; // earliest step (u-sec), negative == early
+  int32_t maxError = 0; // latest step (u-sec)
+  int32_t meanError = 0; // average error (u-sec)
+};
+
+// Ramp Plan
+// A trapezoidal (or triangular) move computed in thread context when a move starts so that
+// Run_ISR() only has to count steps and refine the step interval
+struct RampPlan{
+  bool direction = false; // direction of the move, 1 == CW
+  bool sCurve = false; // true if the ramp intervals come from the S-curve table instead of the Newton recurrence
+  uint8_t sCurveTable = 0; // the shared S-curve table the intervals come from, if sCurve
+  bool accelerating = true; // true if the ramp speeds up to the cruise speed, false if it slows down to it
+  bool constantSpeed = false; // a Constant Speed change blending to its new speed, stop() and pause() still stop immediately
+  uint64_t deltaQ = 0; // change in speed squared per step, 2 * acceleration (see RAMP_Q_SHIFT). 0 == Constant Speed
+  uint32_t steps = 0; // total steps in the move (RAMP_INDEFINITE == no target)
+  uint32_t accelSteps = 0; // steps spent changing speed from the start speed to the cruise speed
+  uint32_t decelSteps = 0; // steps spent decelerating to a stop at the end of the move
+  uint64_t startQ = 0; // speed squared at the start of the move (0 == starting at rest)
+  uint32_t cruiseInterval = 0; // step interval at the cruise speed (u-sec), truncated
+  uint32_t cruiseRemainder = 0; // the truncated fraction of cruiseInterval, in 1/cruiseSpeed u-sec
+  uint32_t cruiseSpeed = 0; // the cruise speed (mSteps/sec)
+  uint32_t firstInterval = 0; // time until the first step of the move (u-sec)
+};
+
+// Set Cruise Rate
+// Sets the cruise interval of a plan and keeps the fraction of a u-sec it is truncated by, 10^9 / speed is
+// cruiseInterval + cruiseRemainder / cruiseSpeed. Run_ISR() carries the fraction from step to step so the
+// long-run rate is exact. Thread context only.
+// \param[RampPlan&] plan - the plan to set
+// \param[i32] speed - the cruise speed (mSteps/sec), 0 == stop
+inline void setCruiseRate(RampPlan &plan, int32_t speed){
+  uint32_t divisor = (speed < 0) ? -(uint32_t)speed : speed;
+  plan.cruiseInterval = milliStepsToUsecInterval(speed);
+  plan.cruiseRemainder = (divisor) ? 1000000000 - plan.cruiseInterval * divisor : 0;
+  plan.cruiseSpeed = divisor;
+}
+
+// Ramp State
+// Progress along a ramp, advanced one step at a time by computeRampInterval()
+struct RampState{
+  RampPlan plan; // the ramp currently being run
+  RampPlan nextPlan; // the ramp to run once the current one stops (used when reversing direction)
+  volatile bool hasNextPlan = false; // true if nextPlan should start when plan completes
+  volatile uint32_t step = 0; // steps taken in the current ramp
+  uint64_t q = 0; // current speed squared (see RAMP_Q_SHIFT)
+  uint32_t carry = 0; // cruise interval fraction carried to the next step, in 1/plan.cruiseSpeed u-sec
+  uint8_t sCurveIndex = 0; // table entry of the last S-curve lookup
+};
+
+// Compiled Moves
+// A move from rest compiled into a table of step intervals in thread context, so Run_ISR() only adds an
+// entry to the last interval each step. The table is streamed through the two chunks of a CompiledBuffer:
+// Run_ISR() plays one while compileMoves() fills the other. Each entry is the change from the last
+// interval (u-sec), or one of these escapes:
+#define COMPILED_ABSOLUTE INT16_MIN // the next two entries are the interval, high half first
+#define COMPILED_END (INT16_MIN + 1) // the move is complete
+
+struct CompiledChunk{
+  int16_t entry[COMPILED_CHUNK_SIZE];
+  uint16_t length = 0; // entries used
+  volatile bool full = false; // set by the compiler once the chunk is filled, cleared by Run_ISR() once played
+};
+
+struct CompiledBuffer{
+  CompiledChunk chunk[2];
+  uint8_t fillChunk = 0; // chunk the compiler fills next
+  uint8_t playChunk = 0; // chunk Run_ISR() is playing, owned by Run_ISR()
+  uint16_t playIndex = 0; // next entry of playChunk, owned by Run_ISR()
+  RampState cursor; // the compiler's copy of the ramp, up to two chunks ahead of the motor
+  int32_t cursorInterval = 0; // cursor step interval without the cruise carry (u-sec)
+  int32_t lastInterval = 0; // last compiled interval, the next entry is the change from it (u-sec)
+  bool done = false; // true once COMPILED_END is compiled
+  volatile uint32_t underruns = 0; // moves that ran out of compiled steps and were finished by Run_ISR()
+};
+
+// Move Segment
+// A queued move, planned in thread context by queueMove() so Run_ISR() only has to copy it in
+struct MoveSegment{
+  RampPlan plan; // plan.deltaQ == 0 for Constant Speed moves
+  int32_t target = 0; // position at the end of the move (steps)
+};
+
+// Motion Command
+// The motion Run_ISR() steps a running motor with, planned in thread context and handed over through the
+// stepper's mailbox (see composeCommand()). Run_ISR() adopts the latest command whole, at a step boundary.
+struct MotionCommand{
+  RampState ramp;
+  int32_t stepInterval = 0; // the last step interval (u-sec), 0 == stop
+  int32_t target = 0; // position at the end of the move (steps), used if hasTarget
+  int32_t position = 0; // _position the command was planned from, Run_ISR() counts the steps taken since
+  bool direction = false;
+  bool hasTarget = false; // false == run indefinitely, or stop where the motor is
+};
+
+// S-Curve Table
+// Jerk-limited ramp from rest to the cruise speed, sampled at even time intervals so the
+// slow (and quickly changing) start of the ramp gets as many entries as the fast end.
+// Decelerations play the table backwards. Built in thread context by buildSCurve(), in a table no ramp
+// Run_ISR() can reach is using, and handed over with the plan that refers to it. A table only depends on its
+// profile, so steppers moving with the same one share it and it is never changed while any of them use it.
+struct SCurveEntry{
+  uint32_t position; // steps from rest
+  uint32_t interval; // step interval at position (u-sec)
+  int32_t slope; // change in interval per step until the next entry (u-sec, SCURVE_SLOPE_SHIFT fraction bits)
+};
+
+struct SCurveTable{
+  SCurveEntry entry[SCURVE_TABLE_SIZE];
+  uint32_t speed = 0; // profile the table was built for: cruise speed (mSteps/sec), 0 == never built
+  uint32_t acceleration = 0; // mSteps/sec^2
+  uint32_t jerk = 0; // mSteps/sec^3
+};
+
+// Step Edge
+// Step pins raised by one Run_ISR() pass, lowered (and direction pins written) by the first pass at or after due
+struct StepEdge{
+  uint32_t due = 0; // scheduler time to lower the pins (u-sec)
+  uint8_t portsUsed = 0; // bitmap of stepPorts with pins to write
+  uint16_t steps[MAX_STEP_PORTS]; // step pins to lower
+  uint16_t dirSet[MAX_STEP_PORTS]; // direction pins to set
+  uint16_t dirReset[MAX_STEP_PORTS]; // direction pins to clear
+};
+
+// Step Timer
+// A hardware timer and the scheduler of the steppers it steps. Each timer runs its own Run_ISR() pass over
+// its own steppers, so the work of an interrupt grows with its share of the steppers rather than all of them.
+// Running steppers are kept in a binary min-heap ordered by the time of their next step, so Run_ISR() only
+// touches the steppers that are due. The heap is stored as arrays of due times and registry slots: sifting
+// and finding the due steppers read contiguous memory and never dereference a stepper. The heap is owned by
+// Run_ISR(), steppers started from thread context are passed to it through scheduleQueue (single producer /
+// single consumer).
+struct StepTimer{
+  IntervalTimer timer;
+  bool enabled = false; // true while the timer is calling Run_ISR()
+  bool unavailable = false; // true if begin() failed, the hardware timer is used by something else
+  uint32_t schedulerTime = 0; // time of the current Run_ISR() (u-sec)
+  uint32_t schedulerTicks = 0; // CPU_Ticks() when schedulerTime was last advanced
+  uint32_t schedulerTickRemainder = 0; // ticks not yet added to schedulerTime
+  uint32_t dueTime[MAX_STEPPERS]; // scheduler time of the next step of each heap entry (u-sec)
+  uint8_t dueSlot[MAX_STEPPERS]; // registry slot of each heap entry
+  uint8_t dueHeapSize = 0;
+  StepperPtr scheduleQueue[SCHEDULE_QUEUE_SIZE];
+  volatile uint8_t scheduleQueueHead = 0;
+  volatile uint8_t scheduleQueueTail = 0;
+  StepEdge edges[STEP_EDGE_QUEUE_SIZE]; // pending falling edges, oldest first, owned by Run_ISR()
+  uint8_t edgeHead = 0;
+  uint8_t edgeCount = 0;
 };
 
 
 // This is your main class that users will import into their application
 class VDW_Stepper
 {
+  friend class StepperGroup;
+
 public:
 
   // CONSTRUCTOR
-  // Adds the stepper to the list
+  // Attaches the stepper to the registry
   VDW_Stepper();
 
+  // DESTRUCTOR
+  // Detaches the stepper, so steppers can be created and destroyed at runtime
+  ~VDW_Stepper();
+
+  // A stepper owns its registry slot, a copy would free it when destroyed
+  VDW_Stepper(const VDW_Stepper&) = delete;
+  VDW_Stepper& operator=(const VDW_Stepper&) = delete;
+
+  // Attach
+  // Takes a free slot in the registry, a stepper can only run while it has one. Called by the constructor.
+  // \return[bool] false if all MAX_STEPPER_SLOTS slots are taken
+  bool attach();
+
+  // Detach
+  // Stops the motor immediately and gives its slot back to the registry, the slot is free for another
+  // stepper. Called by the destructor. Thread context only.
+  void detach();
+
   // Init
   // Provides the stepper with functions to call when a clockwise or counterClockwise step is called
   // \param[void func(void)] clockwise - the clockwise step function
@@ -46,10 +390,20 @@ public:
   // \parat[void func(void)] disable - the disable function for the stepper [optional]
   void init(void (*clockwise)(), void(*counterClockwise)(), void(*enable)()=nullptr, void(*disable)()=nullptr);
 
+  // Init Pins
+  // Drives a step/direction driver directly instead of calling step functions. Run_ISR() collects the steps
+  // of every stepper due in a pass and writes each GPIO port once for the rising edge and once for the
+  // falling edge, so steps on different axes are simultaneous.
+  // \param[u16] stepPin - the step pin, pulsed high for the pulse width (see setStepTiming()) each step
+  // \param[u16] dirPin - the direction pin, high == CW
+  // \param[i16] enablePin - the enable pin, active low. -1 == no enable pin [optional]
+  // \return[bool] false if the pins are on more than MAX_STEP_PORTS ports
+  bool initPins(uint16_t stepPin, uint16_t dirPin, int16_t enablePin=-1);
+
   // Run Speed
   // Move the motor indefinitely with the last set or provided settings
   // Using any of the optional parameters does NOT overide the speed, acceleration or mode settings
-  // \param[Mode] mode - the mode of the stepper. Constant Speed or Accelerations [optional]
+  // \param[Mode] mode - the mode of the stepper. Constant Speed, Accelerations or SCurve [optional]
   // \param[i32] speed - the speed of the motor will turn (mSteps/sec). Negative == CCW, Positive == CW [optional]
   // \param[u32] acceleration - the acceleration for the motor. (mSteps/sec^2) [optional]
   void run(Mode mode=NoChange, int32_t speed=0, uint32_t acceleration=0);
@@ -58,7 +412,7 @@ public:
   // Move the motor to a new target position.
   // Using any of the optional parameters does NOT overide the speed, acceleration or mode settings.
   // \param[i32] position - the new target position (steps). Negative == CCW, Positive == CW
-  // \param[Mode] mode - the mode of the stepper. Constant Speed or Accelerations [optional]
+  // \param[Mode] mode - the mode of the stepper. Constant Speed, Accelerations or SCurve [optional]
   // \param[i32] speed - the speed of the motor will turn (mSteps/sec). Negative == CCW, Positive == CW [optional]
   // \param[u32] acceleration - the acceleration for the motor. (mSteps/sec^2) [optional]
   void moveAbsolute(int32_t position, Mode mode=NoChange, int32_t speed=0, uint32_t acceleration=0);
@@ -68,7 +422,7 @@ public:
   // Updates the target position and keeps current position accurate.
   // Using any of the optional parameters does NOT overide the speed, acceleration or mode settings.
   // \param[i32] position - the new target position (steps). Negative == CCW, Positive == CW
-  // \param[Mode] mode - the mode of the stepper. Constant Speed or Accelerations [optional]
+  // \param[Mode] mode - the mode of the stepper. Constant Speed, Accelerations or SCurve [optional]
   // \param[i32] speed - the speed of the motor will turn (mSteps/sec). Negative == CCW, Positive == CW [optional]
   // \param[u32] acceleration - the acceleration for the motor. (mSteps/sec^2) [optional]
   void moveRelative(int32_t distance, Mode mode=NoChange, int32_t speed=0, uint32_t acceleration=0);
@@ -92,20 +446,237 @@ public:
   void eStop();
 
   // Disable
-  // Disables the stepper motor by calling the disable function passed in init
-  // if motor is currently running. stop() is called prior to disable
+  // Disables the stepper motor by calling the disable function passed in init (or raising the initPins() enable pin)
+  // if motor is currently running, it is stopped immediately prior to disable
   void disable();
 
   // Enable
-  // Enables the stepper motor by calling the enable function provided in init.
+  // Enables the stepper motor by calling the enable function provided in init (or lowering the initPins() enable pin).
   // Not necessary to call before move functions. Move functions will call automatically.
   // Only needed if the stepper motors are disabled outside of the library.
   void enable();
 
+  // Resume
+  // Resumes a move that was stopped with pause() and releases the move queue
+  void resume();
+
+  // Queue Move
+  // Adds a move to a new target position to the end of the stepper's move queue.
+  // Queued moves start from Run_ISR() the instant the previous move ends, with no idle time between them.
+  // Starts immediately if the stepper is idle. Accelerations moves start and end at rest, SCurve moves are
+  // queued as Accelerations moves. Settings not passed are taken from the normal settings when queued.
+  // \param[i32] position - the target position (steps)
+  // \param[Mode] mode - the mode of the move. Constant Speed, Accelerations or SCurve [optional]
+  // \param[i32] speed - the speed of the move (mSteps/sec) [optional]
+  // \param[u32] acceleration - the acceleration of the move (mSteps/sec^2) [optional]
+  // \return[bool] false if the queue is full
+  bool queueMove(int32_t position, Mode mode=NoChange, int32_t speed=0, uint32_t acceleration=0);
+
+  // Queue Available
+  // \return[u8] the number of moves that can be added to the queue
+  uint8_t queueAvailable();
+
+  // Clear Queue
+  // Removes all queued moves. Does not stop the current move. Called by stop(), eStop() and disable()
+  void clearQueue();
+
+  // Set Compiled Buffer
+  // Compiles moveAbsolute() and moveRelative() moves that start from rest in Accelerations or SCurve mode into
+  // a table of step intervals in thread context, Run_ISR() only plays the table back. The table is streamed
+  // through the buffer whatever the length of the move; call compileMoves() from loop() often enough to refill
+  // a chunk while the other one plays (COMPILED_CHUNK_SIZE steps). If Run_ISR() runs out it finishes the move
+  // with the live ramp math and counts an underrun. Other moves, and changes to a compiled move, are computed
+  // by Run_ISR() as usual.
+  // \param[CompiledBuffer*] buffer - the buffer, one per stepper. nullptr == off
+  void setCompiledBuffer(CompiledBuffer *buffer);
+
+  // Compile Moves
+  // Refills the buffers of every stepper playing a compiled move. Call from loop().
+  static void compileMoves();
+
+  // Home
+  // Runs toward a limit switch with the normal mode and acceleration. The position is latched by the edge
+  // interrupt of the switch the instant it is hit and Run_ISR() decelerates the motor to a stop at its next
+  // step, so the result does not depend on the approach speed. With a touch speed the motor then backs off and touches the
+  // switch again at the touch speed, at constant speed, and that touch is latched instead. currentPosition()
+  // is set so the latched point is at position. The limit interrupt must not preempt Run_ISR() for longer
+  // than a step. Poll homingState() from loop() to start the second touch and set the position.
+  // \param[u16] limitPin - the switch input, set up with pinMode() first
+  // \param[i32] speed - the speed and direction toward the switch (mSteps/sec), 0 == the set speed [optional]
+  // \param[u32] touchSpeed - the speed of the second touch (mSteps/sec), 0 == no second touch [optional]
+  // \param[u32] backoff - steps to back off past the first latch before the second touch [optional]
+  // \param[i32] position - the position of the switch (steps) [optional]
+  // \param[bool] activeHigh - true if the input goes high when the switch is hit [optional]
+  // \return[bool] false if the switch is already hit or the stepper is running
+  bool home(uint16_t limitPin, int32_t speed=0, uint32_t touchSpeed=0, uint32_t backoff=0, int32_t position=0, bool activeHigh=true);
+
+  // Homing State
+  // Starts the second touch once the motor stopped at the switch and sets the position. Thread context only.
+  // \return[HomingState] the progress of home(). Releases the switch interrupt once homing is over
+  HomingState homingState();
+
+  // Set Encoder
+  // Adds an encoder, checked by reconcileEncoders(). The encoder position is taken to be currentPosition() now.
+  // A following error beyond the window is flagged and, with correct, made up by moving the missing steps:
+  // while cruising to a target the steps are added to the move, at rest the motor moves back to its target,
+  // running indefinitely only currentPosition() is corrected. An error of stallError or more is a stall: the
+  // motor stops immediately and currentPosition() is set to the encoder position.
+  // \param[i32 func(void)] readEncoder - returns the encoder count, counting up CW. nullptr == no encoder
+  // \param[i32] counts - encoder counts per steps steps [optional]
+  // \param[i32] steps - steps per counts encoder counts [optional]
+  // \param[u32] followingWindow - following error allowed (steps) [optional]
+  // \param[u32] stallError - following error that is a stall (steps), 0 == never [optional]
+  // \param[bool] correct - true to move the missing steps [optional]
+  void setEncoder(int32_t (*readEncoder)(), int32_t counts=1, int32_t steps=1, uint32_t followingWindow=1, uint32_t stallError=0, bool correct=false);
+
+  // Reconcile Encoders
+  // Compares the encoder of every stepper that has one with its position, flags following errors and
+  // stalls and makes the corrections. Call from loop(), ie every 10ms; the stall error is the most steps
+  // a motor can lose between two calls.
+  static void reconcileEncoders();
+
+  // Clear Stall
+  // Clears ENCODER_STALLED, ie once the cause of the stall is fixed
+  void clearStall();
+
+  // SETTERS
+  // Set Max Speed
+  // Set the maximum permitted speed. Does NOT set the current/target speed. 0 == No Max
+  // \param[i32] speed - the maximum safe speed (mSteps/sec)
+  void setMaxSpeed(int32_t speed);
+
+  // Set Acceleration
+  // \param[u32] acceleration - the acceleration for the motor (mSteps/sec^2)
+  void setAcceleration(uint32_t acceleration);
+
+  // Set Speed
+  // \param[i32] speed - the target speed (mSteps/sec). Negative == CCW, Positive == CW
+  void setSpeed(int32_t speed);
+
+  // Set Mode
+  // \param[Mode] mode - Constant Speed, Accelerations or SCurve
+  void setMode(Mode mode);
+
+  // Set Jerk
+  // Used in SCurve mode. 0 == no jerk limit (SCurve behaves like Accelerations)
+  // \param[u32] jerk - the rate of change of acceleration (mSteps/sec^3)
+  void setJerk(uint32_t jerk);
+
+  // Set Current Position
+  // Also sets the target position
+  // \param[i32] position - the new current position (steps)
+  void setCurrentPosition(int32_t position);
+
+  // Set Step Timing
+  // Pulse timing of the drivers of initPins() steppers. Run_ISR() raises the step pins and lowers them from
+  // a later pass, it never waits for a pulse to end. Direction changes are written with the falling edge of
+  // the last step (at least dirHold after it) and the next step waits at least dirSetup after that.
+  // The pulse width must be shorter than the step interval at the highest speed.
+  // \param[u8] pulseWidth - minimum step pulse high time (u-sec)
+  // \param[u8] dirSetup - minimum time from a direction change to the next step (u-sec)
+  // \param[u8] dirHold - minimum time from a step to a direction change (u-sec)
+  static void setStepTiming(uint8_t pulseWidth, uint8_t dirSetup, uint8_t dirHold);
+
+  // Set Feed Override
+  // Scales the speed of every stepper. Applied by Run_ISR() to each step interval as it is scheduled, so
+  // nothing is re-planned: the change takes effect from the next step of each motor. Accelerations scale
+  // with the square of the override, change it in small steps while motors are running.
+  // \param[u16] percent - MIN_FEED_OVERRIDE to MAX_FEED_OVERRIDE, 100 == programmed speed
+  static void setFeedOverride(uint16_t percent);
+  static uint16_t getFeedOverride(){ return VDW_Stepper::feedOverride; }
+
+  // Set Timer
+  // Steppers are spread across STEP_TIMERS hardware timers. By default a stepper starting from rest goes to the
+  // first timer whose expected step rate (the sum of the speeds of the steppers running on it) stays within
+  // STEP_TIMER_MAX_RATE, so steppers share one interrupt, and step in the same passes, until it is busy. A hint
+  // keeps the stepper on one timer, ie to keep the fast axes apart. Takes effect the next time it starts from rest.
+  // \param[i8] timer - the timer, 0 to STEP_TIMERS - 1. -1 == automatic
+  void setTimer(int8_t timer);
+
+  // GETTERS
+  int32_t getMaxSpeed(){ return _safeSpeed; }
+  int32_t getTargetSpeed(){ return _speed; }
+  uint32_t getJerk(){ return _jerk; }
+  int32_t getCurrentSpeed(); // the current speed (mSteps/sec). Negative == CCW, Positive == CW
+  int32_t distanceToGo(){ return targetPosition() - _position; }
+  int32_t targetPosition(); // includes a command Run_ISR() has not adopted yet
+  int32_t currentPosition(){ return _position; }
+  bool isRunning(){ return _stepTime > 0 || _minorAxis; } // a minor axis of a StepperGroup runs until the group finishes
+  uint8_t getTimer(){ return _timer; } // the timer stepping the motor (see setTimer())
+  uint8_t getSlot(){ return _slot; } // the registry slot, the stepper's number in step captures. NO_SLOT if not registered
+  int32_t encoderPosition(); // the position measured by the encoder (steps)
+  int32_t followingError(){ return _followingError; } // currentPosition() - encoderPosition() at the last reconcileEncoders()
+  EncoderState encoderState(){ return _encoderState; }
+  uint32_t encoderStalls(){ return _encoderStalls; } // stalls detected
+  int32_t encoderCorrection(){ return _encoderCorrection; } // steps moved to correct following errors, CW positive
+
   // printSteppers
-  // Prints a list of all the stepper pointers
+  // Prints the registry, the stepper pointer in each slot
   static void printSteppers();
 
+  // Drain Log
+  // Prints and removes the events Run_ISR() has logged since the last call. Call from loop().
+  // Does nothing if ISR_LOG is not defined.
+  // \param[Print&] output - where to print the log, ie Serial
+#if defined(ISR_LOG)
+  static void drainLog(Print &output);
+#else
+  static void drainLog(Print &){}
+#endif
+
+  // ISR Statistics
+  // Copies the Run_ISR() statistics, read atomically. All zero if ISR_STATS is not defined.
+  // \param[ISRStats&] stats - returns the statistics
+#if defined(ISR_STATS)
+  static void getISRStats(ISRStats &stats);
+  static void resetISRStats();
+#else
+  static void getISRStats(ISRStats &stats){ stats = ISRStats(); }
+  static void resetISRStats(){}
+#endif
+
+  // Step Statistics
+  // Copies the step timing error of this stepper, read atomically. All zero if ISR_STATS is not defined.
+  // The error is measured from when Run_ISR() started, steps due within MIN_TIME_BETWEEN_RUN_ISR are taken early.
+  // \param[StepStats&] stats - returns the statistics
+#if defined(ISR_STATS)
+  void getStepStats(StepStats &stats);
+  void resetStepStats();
+#else
+  void getStepStats(StepStats &stats){ stats = StepStats(); }
+  void resetStepStats(){}
+#endif
+
+  // Step Capture
+  // Records every step of every stepper while on: the stepper's registry slot, the direction, the CPU_Ticks()
+  // of the Run_ISR() pass that stepped it and how late the step was against its scheduled time (u-sec).
+  // Records are delta-encoded, 3 bytes for a step in the same pass as the last one, 5 for a pass 17 to 2000 u-sec
+  // later (at 120MHz).
+  // Steps that do not fit in the ring are dropped and counted, dump often enough to keep up.
+  // Does nothing if STEP_CAPTURE is not defined.
+  // Capture Records:
+  //   [0]   slot | direction << 6 (1 == CW) | 0x80 if absolute
+  //   [1-]  absolute: CPU_Ticks() (u32, little-endian), otherwise the CPU_Ticks() since the last record
+  //         (unsigned LEB128, 7 bits a byte, low bits first). The first record and the first after a drop are absolute
+  //   [n]   lateness (i8, u-sec, clamped to +-127)
+#if defined(STEP_CAPTURE)
+  static void startCapture();
+  static void stopCapture();
+#else
+  static void startCapture(){}
+  static void stopCapture(){}
+#endif
+
+  // Dump Capture
+  // Prints and removes the captured records as hex lines, "C <hex>", after a "#STEPCAP" header line. Call
+  // from loop(). Does nothing if STEP_CAPTURE is not defined.
+  // \param[Print&] output - where to print the capture, ie Serial
+#if defined(STEP_CAPTURE)
+  static void dumpCapture(Print &output);
+#else
+  static void dumpCapture(Print &){}
+#endif
+
 private:
   // STEPPER MOTOR FUNCTIONS
   void (*_clockwise)();
@@ -114,19 +685,21 @@ private:
   void (*_disableStepper)();
 
   // SETTINGS
-  Mode _mode = ConstantSpeed; // Stepper Mode (Constant Speed or Accelerations)
+  Mode _mode = ConstantSpeed; // Stepper Mode (Constant Speed, Accelerations or SCurve)
   int32_t _speed = 0; // target speed (mStep/sec)
   uint32_t _acceleration = 0; // acceleration (mStep/sec^2)
-  Mode _tempMode = NoChange; // temporary mode (Constant Speed or Accelerations)
+  uint32_t _jerk = 0; // jerk, SCurve mode only (mStep/sec^3)
+  Mode _tempMode = NoChange; // temporary mode (Constant Speed, Accelerations or SCurve)
   int32_t _tempSpeed = 0; // temporary target speed (mStep/sec)
   uint32_t _tempAcceleration = 0; // temporary acceleration (mStep/sec^2)
   int32_t _safeSpeed = 0; // the maximum safe speed a motor should every be run. 0 == No Max
 
   // POSITIONING
   bool _hasTarget = false; // True if the motor is currently running to a target postion (temp or normal). False if running indefinitely
-  int32_t _position = 0; // The current position of the motor in steps. Negative == CCW, Positive == CW
+  volatile int32_t _position = 0; // The current position of the motor in steps. Negative == CCW, Positive == CW
   int32_t _target = 0; // The position the motor is moving to in steps. Negative == CCW, Positive = CW
   int32_t _tempTarget = 0; // Temporary target position. (used in pause)
+  bool _resumeToTarget = false; // True if resume() should continue to _tempTarget. False to run indefinitely
 
   // STEP DATA
   volatile bool _direction = false; // current direction the motor is spinning, 1 == CW
@@ -134,17 +707,247 @@ private:
   volatile int32_t _stepInterval = 0; // the time between the steps (value < 1 means no steps)
   
   // STEP TIMING
-  volatile static int lastDuration; // amount of time between Run_ISR() calls
-  volatile int _stepTime = 0; // amount of time until the next step (value < 1 means no step due)
+  uint8_t _timer = 0; // index of the StepTimer that steps the motor, changed only while it is idle
+  int8_t _timerHint = -1; // timer set with setTimer(), -1 == automatic
+  volatile int _stepTime = 0; // time from scheduling until the next step, then the last step interval (value < 1 means stopped)
+  volatile bool _schedulePending = false; // true while waiting in the timer's scheduleQueue
+  uint16_t _feedCarry = 0; // fraction of a u-sec left over by feedInterval(), owned by Run_ISR()
 
-  // STEPPER LIST MEMBERS
-  StepperPtr next = nullptr; // pointer to next stepper
-  static StepperPtr head; // the first stepper in the list
+  // RAMP DATA
+  RampState _ramp; // the ramp being run
+
+  // MAILBOX
+  // Changes to a running motor are posted here rather than written to the fields Run_ISR() is using, so no
+  // interrupts are disabled. The thread only writes the buffer Run_ISR() is not reading, then publishes it
+  // by incrementing _commandSeq; Run_ISR() adopts the latest command before the next step of the motor, or
+  // when requestSchedule() reschedules it. A stopped motor is not read by Run_ISR() and adopts in thread context.
+  MotionCommand _commands[2]; // the posted command is _commands[_commandSeq & 1]
+  volatile uint8_t _commandSeq = 0; // sequence number of the last posted command, written by the thread
+  volatile uint8_t _adoptedSeq = 0; // sequence number of the last adopted command
+  volatile uint8_t _motionCount = 0; // incremented whenever Run_ISR() changes the motion, to copy it consistently
+
+  // MOVE QUEUE
+  // Single producer (thread) / single consumer ring buffer, no interrupts are disabled. The consumer is
+  // Run_ISR() while the stepper is running and the thread while it is idle; Run_ISR() never touches an
+  // idle stepper so only one of them consumes at a time.
+  MoveSegment _queue[MOVE_QUEUE_SIZE];
+  volatile uint8_t _queueHead = 0; // next segment to run, written by the consumer
+  volatile uint8_t _queueTail = 0; // next free slot, written by the producer
+  volatile uint8_t _flushTo = 0; // _queueTail when clearQueue() was called
+  volatile bool _flushQueue = false; // the consumer should drop segments up to _flushTo
+  volatile bool _holdQueue = false; // true while paused, queued moves wait for resume()
+  int32_t _queueEnd = 0; // target of the last queued segment
+
+#if defined(ISR_STATS)
+  // STEP STATISTICS
+  StepStats _stepStats; // meanError is filled in by getStepStats()
+  int64_t _stepErrorTotal = 0; // sum of step errors (u-sec)
+#endif
+
+  // STEP PINS
+  // Set by initPins(), step callbacks are not used
+  GPIOPort _stepPort = nullptr; // nullptr == step with the callbacks from init()
+  uint16_t _stepMask = 0; // step pin bit in its port
+  uint8_t _stepPortIndex = 0; // step pin port in stepPorts
+  uint16_t _dirMask = 0; // direction pin bit in its port
+  uint8_t _dirPortIndex = 0; // direction pin port in stepPorts
+  bool _dirState = false; // level last written to the direction pin
+  GPIOPort _enablePort = nullptr; // nullptr == no enable pin
+  uint16_t _enableMask = 0; // enable pin bit in its port
+
+  // COMPILED MOVES
+  CompiledBuffer* _compiled = nullptr; // set with setCompiledBuffer(), nullptr == not compiled
+  volatile bool _compiledPlaying = false; // true while Run_ISR() plays _compiled, cleared by whoever stops it
+
+  // ENCODER
+  int32_t (*_readEncoder)() = nullptr;
+  int32_t _encoderCounts = 1; // encoder counts per _encoderSteps steps
+  int32_t _encoderSteps = 1;
+  int32_t _encoderOffset = 0; // _position - the encoder count in steps, when they agree
+  uint32_t _followingWindow = 1; // steps
+  uint32_t _stallError = 0; // steps, 0 == no stall detection
+  bool _encoderCorrect = false;
+  EncoderState _encoderState = ENCODER_NONE;
+  int32_t _followingError = 0;
+  uint32_t _encoderStalls = 0;
+  int32_t _encoderCorrection = 0;
+  int32_t _encoderCorrecting = 0; // steps corrected since the motor was last within the window
+
+  // HOMING
+  volatile HomingState _homingState = HOMING_IDLE;
+  uint16_t _homePin = 0; // limit switch input
+  bool _homeAttached = false; // true while the switch interrupt is attached
+  bool _homeDirection = false; // direction toward the switch, 1 == CW
+  uint32_t _homeSpeed = 0; // speed toward the switch (mSteps/sec), the back off runs at it too
+  uint32_t _homeTouchSpeed = 0; // speed of the second touch (mSteps/sec), 0 == none
+  uint32_t _homeBackoff = 0; // steps to back off past the first latch
+  int32_t _homePosition = 0; // position of the switch
+  volatile int32_t _homeLatch = 0; // _position when the switch was hit, written by homeISR()
+  volatile bool _homeLatched = false; // set by homeISR(), cleared by homingState() once it has acted on the latch
+  volatile bool _homeStopping = false; // homeStop() is stopping the motor at the latch, homingState() waits for it to stop
+
+  // COORDINATED MOVES
+  StepperGroup* _group = nullptr; // group to step along with this stepper (this stepper is the dominant axis)
+  volatile bool _minorAxis = false; // true while a group's dominant axis steps this stepper
+
+  // STEPPER REGISTRY
+  // Every stepper has a slot, fixed when it is constructed. Scheduler state is kept in arrays indexed by slot
+  // rather than in the steppers, so Run_ISR() only reads the steppers that step
+  uint8_t _slot = NO_SLOT; // index in slots
+  static StepperPtr slots[MAX_STEPPER_SLOTS];
+  static uint32_t slotMap[SLOT_WORDS]; // bitmap of attached slots
+  static volatile uint32_t activeMap[SLOT_WORDS]; // bitmap of scheduled slots, in a heap or a scheduleQueue. Set by requestSchedule(), cleared by Run_ISR()
+  static uint8_t heapIndex[MAX_STEPPER_SLOTS]; // entry of each slot in its timer's heap, HEAP_NONE if not in it, owned by Run_ISR()
 
   ///RUN ISR MEMBERS
-  static IntervalTimer Step_Timer;
-  static void Run_ISR();
-  static bool ISR_Enabled;
+  static StepTimer stepTimers[STEP_TIMERS];
+  static void (*const timerISR[5])(); // Timer_ISR<0> to Timer_ISR<4>, the callbacks given to IntervalTimer
+  template<uint8_t index> static void Timer_ISR(){ Run_ISR(VDW_Stepper::stepTimers[index]); }
+  static void Run_ISR(StepTimer &timer);
+
+  // S-CURVE TABLES
+  // Shared by every stepper, see RampPlan::sCurveTable. Built in thread context only
+  static SCurveTable sCurveTables[SCURVE_TABLES];
+
+#if defined(ISR_LOG)
+  // ISR LOG
+  // Single producer (Run_ISR()) / single consumer (drainLog()) ring buffer
+  static LogEntry logBuffer[ISR_LOG_SIZE];
+  static volatile uint8_t logHead; // next entry to print, written by drainLog()
+  static volatile uint8_t logTail; // next free entry, written by Run_ISR()
+  static volatile uint32_t logDropped; // entries dropped because the log was full
+  static uint32_t logDroppedReported; // logDropped when drainLog() last reported it
+  static void logEvent(uint8_t event, int32_t arg1, int32_t arg2);
+#endif
+
+#if defined(STEP_CAPTURE)
+  // STEP CAPTURE
+  // Single producer (Run_ISR()) / single consumer (dumpCapture()) byte ring
+  static uint8_t captureBuffer[STEP_CAPTURE_SIZE];
+  static volatile uint16_t captureHead; // next byte to print, written by dumpCapture()
+  static volatile uint16_t captureTail; // next free byte, written by Run_ISR()
+  static volatile bool capturing;
+  static bool captureSync; // true to write an absolute record next
+  static bool captureHeader; // true once dumpCapture() printed the header of this capture
+  static uint32_t captureTicks; // CPU_Ticks() of the current Run_ISR() pass
+  static uint32_t captureLastTicks; // CPU_Ticks() of the last record
+  static volatile uint32_t captureDropped; // steps dropped because the ring was full
+  static uint32_t captureDroppedReported; // captureDropped when dumpCapture() last reported it
+  static void captureStep(uint8_t slot, bool direction, int32_t lateness);
+#endif
+
+#if defined(ISR_STATS)
+  // ISR STATISTICS
+  static ISRStats isrStats; // meanTicks and invocationsPerSecond are filled in by getISRStats()
+  static uint64_t isrTicksTotal; // sum of Run_ISR() durations (CPU ticks)
+  static uint32_t isrWindowStart; // CPU_Ticks() the invocationsPerSecond window started
+  static uint32_t isrWindowCount; // Run_ISR() calls in the window, 0 to restart the window
+  static uint32_t isrLastWindowCount; // Run_ISR() calls in the last complete window
+  static uint32_t isrLastWindowTicks; // length of the last complete window (CPU ticks), 0 == none yet
+  static void recordISRStats(uint32_t started, uint32_t ticks);
+  void recordStepError(int32_t error);
+#endif
+
+  // STEP PORTS
+  // GPIO ports used by initPins() steppers and the pins to write on them in the current Run_ISR() pass
+  static GPIOPort stepPorts[MAX_STEP_PORTS];
+  static uint8_t numStepPorts;
+  static uint16_t stepPortSteps[MAX_STEP_PORTS]; // step pins to pulse
+  static uint16_t stepPortDirSet[MAX_STEP_PORTS]; // direction pins to set
+  static uint16_t stepPortDirReset[MAX_STEP_PORTS]; // direction pins to clear
+  static uint8_t stepPortsUsed; // bitmap of stepPorts with pins to write
+  static uint8_t stepPulseWidth; // set with setStepTiming() (u-sec)
+  static uint8_t stepDirSetup;
+  static uint8_t stepDirHold;
+
+  // Step Port Index
+  // Finds or adds a port to stepPorts. Thread context only.
+  // \return[u8] index of the port in stepPorts, MAX_STEP_PORTS if stepPorts is full
+  static uint8_t stepPortIndex(GPIOPort port);
+
+  // Raise Step Pins
+  // Raises every step pin collected by stepOutput() with one write per port
+  static void raiseStepPins();
+
+  // Queue Step Edge
+  // Moves the step pins raised in the pass and the direction changes collected by queueDirection() to a
+  // falling edge of the timer. Run_ISR() leaves steppers that would add an edge due while the queue is
+  // full, so there is always room. Run_ISR() only
+  // \param[u32] due - scheduler time to lower the pins (u-sec)
+  static void queueStepEdge(StepTimer &timer, uint32_t due);
+
+  // Lower Step Edges
+  // Lowers the step pins and writes the direction pins of every falling edge of the timer that is due,
+  // one write per port. Run_ISR() only
+  static void lowerStepEdges(StepTimer &timer, uint32_t now);
+
+  // Step Output
+  // Steps the motor once in _direction. Callback steppers step immediately, pin steppers are added to
+  // the pins raiseStepPins() writes for the pass. The direction pin must already be written
+  void stepOutput(){
+    if(_stepPort == nullptr){
+      (_direction) ? _clockwise() : _counterClockwise();
+      return;
+    }
+    VDW_Stepper::stepPortSteps[_stepPortIndex] |= _stepMask;
+    VDW_Stepper::stepPortsUsed |= 1 << _stepPortIndex;
+  }
+
+  // Queue Direction
+  // Adds a direction change to the falling edge of the pass. Run_ISR() only
+  void queueDirection(){
+    _dirState = _direction;
+    if(_direction) VDW_Stepper::stepPortDirSet[_dirPortIndex] |= _dirMask;
+    else VDW_Stepper::stepPortDirReset[_dirPortIndex] |= _dirMask;
+    VDW_Stepper::stepPortsUsed |= 1 << _dirPortIndex;
+  }
+
+  // Write Direction
+  // Writes the direction pin of an initPins() stepper now, if it has changed
+  void writeDirection(){
+    if(_stepPort == nullptr || _direction == _dirState) return;
+    _dirState = _direction;
+    GPIOPort port = VDW_Stepper::stepPorts[_dirPortIndex];
+    if(_direction) Port_Write(port, _dirMask, 0);
+    else Port_Write(port, 0, _dirMask);
+  }
+
+  // SCHEDULER
+  // The scheduler state of each timer is in its StepTimer. Run_ISR() passes of different timers must not
+  // nest, leave the timers at the same interrupt priority (the SparkIntervalTimer default); the step ports,
+  // the log and the statistics are shared between them.
+  static Reciprocal ticksPerMicrosecond; // CPU_TICKS_PER_MICROSECOND(), set when Run_ISR() starts
+  static uint16_t feedOverride; // percent, set with setFeedOverride()
+  static volatile uint32_t feedScale; // 100 / feedOverride (FEED_SCALE_SHIFT fraction bits), read by Run_ISR()
+  static void heapSiftUp(StepTimer &timer, uint8_t index);
+
+  // Scheduler Clock
+  // Advances the timer's schedulerTime by the CPU ticks elapsed since the last call. Run_ISR() only
+  // \return[u32] the new scheduler time (u-sec)
+  static uint32_t schedulerClock(StepTimer &timer);
+
+  static void heapSiftDown(StepTimer &timer, uint8_t index);
+
+  // Heap Remove
+  // Removes an entry from the heap and its slot from activeMap. Run_ISR(), or thread context with interrupts disabled
+  static void heapRemove(StepTimer &timer, uint8_t index);
+
+  // Next Active
+  // Iterates over the scheduled steppers, only visiting the set bits of activeMap. Thread context only.
+  //   for(uint8_t slot = 0; (cStepper = nextActive(slot)) != nullptr; slot++)
+  // \param[u8&] slot - the slot to start searching from, returns the slot found
+  // \return[StepperPtr] the stepper, nullptr once there are no more
+  static StepperPtr nextActive(uint8_t &slot);
+
+  // Choose Timer
+  // The timer for a stepper starting from rest: the hint if there is one, otherwise the first timer with room
+  // for its speed (see STEP_TIMER_MAX_RATE), or the least loaded timer if none have room. Thread context only.
+  // \return[u8] index of the timer in stepTimers
+  uint8_t chooseTimer();
+
+  // Request Schedule
+  // Passes the stepper to the Run_ISR() of its timer to step _stepTime from the next Run_ISR(). Thread context only.
+  void requestSchedule();
 
   // Compute New Speed
   // Calculates the next _stepInterval. Implements accel/decel and position tracking if not
@@ -152,7 +955,157 @@ private:
   // \return[int32_t] the next step interval (u-sec)
   int32_t computeNewSpeed();
 
+  // Compute Ramp Interval
+  // Advances a ramp by one step and returns the next step interval. Called from Run_ISR() for the stepper's
+  // own ramp (_ramp, _stepInterval, _direction)
+  // \param[RampState&] ramp - the ramp to advance
+  // \param[i32&] interval - the last step interval without the cruise carry (u-sec), updated
+  // \param[bool&] direction - the direction, changed when the next plan starts
+  // \return[int32_t] the next step interval (u-sec), 0 when the ramp is complete
+  int32_t computeRampInterval(RampState &ramp, volatile int32_t &interval, volatile bool &direction);
+
+  // Plan Ramp
+  // Computes the plan of a command (and the next plan if the motor must stop and reverse) from its motion,
+  // target and the active speed and acceleration. Thread context only.
+  // \param[MotionCommand&] motion - the command, see composeCommand()
+  // \param[bool] hasTarget - true if moving to motion.target, false if running indefinitely
+  void planRamp(MotionCommand &motion, bool hasTarget);
+
+  // Build Ramp
+  // Fills a plan for a single move in one direction
+  // \param[i32] cruiseSpeed - the speed to cruise at (mSteps/sec), 0 == decelerate to a stop over the whole move
+  void buildRamp(RampPlan &plan, bool direction, uint32_t steps, uint64_t startQ, int32_t cruiseSpeed, uint64_t deltaQ);
+
+  // Build S-Curve
+  // Fills a plan for a jerk limited move from rest in one direction, with the shared S-curve table of its
+  // profile, built in a free one if there is none yet. Thread context only. Falls back to buildRamp() for moves
+  // too short to fit a single S-curve step, or if every table is in use by other profiles
+  void buildSCurve(RampPlan &plan, bool direction, uint32_t steps, int32_t speed);
+
+  // S-Curve Interval
+  // Looks up and interpolates the step interval at a position along the S-curve table. Called from Run_ISR()
+  // \param[RampState&] ramp - the ramp, keeps the entry for the next lookup
+  // \param[u32] position - steps from rest
+  // \return[u32] the step interval (u-sec)
+  uint32_t sCurveInterval(RampState &ramp, uint32_t position);
+
+  // Start Motion
+  // Common tail of run() and moveAbsolute(). Starts the step timing for the active mode
+  // \param[bool] hasTarget - true if moving to target, false if running indefinitely
+  // \param[i32] target - the position to move to (steps)
+  void startMotion(bool hasTarget, int32_t target=0);
+
+  // Compose Command
+  // Copies the latest motion into the mailbox buffer Run_ISR() is not reading: the posted command if
+  // Run_ISR() has not adopted it yet, otherwise the live motion. Thread context only.
+  // \return[MotionCommand&] the command to change and post
+  MotionCommand& composeCommand();
+
+  // Post Command
+  // Publishes the composed command. A stopped motor adopts it now and starts if it moves
+  // \param[bool] reschedule - true to have Run_ISR() adopt it at once (a start, a new speed or a stop), it
+  //   keeps the step countdown of a moving motor. false to adopt it before the next step
+  void postCommand(bool reschedule);
+
+  // Adopt Command
+  // Makes the posted command the live motion. Called by Run_ISR(), or the thread while the motor is stopped
+  void adoptCommand();
+
+  // Start Stepping
+  // Enables the stepper and starts Run_ISR() if required
+  void startStepping();
+
+  // Pop Segment
+  // Loads the next queued move. Called by the consumer (Run_ISR() at the end of a move, or the thread when idle)
+  // \return[int32_t] the time until the first step of the move (u-sec), 0 if the queue is empty
+  int32_t popSegment();
+
+  // Start Queue
+  // Starts the next queued move if the stepper is idle. Thread context only.
+  void startQueue();
+
+  // Plan Stop
+  // Replaces the ramp of a command with a deceleration to a stop. Thread context only.
+  // \param[MotionCommand&] motion - the command, see composeCommand()
+  void planStop(MotionCommand &motion);
+
+  // Start Compiled
+  // Copies the ramp just planned from rest into the compiler cursor, compiles both chunks and starts playback.
+  // Thread context only.
+  void startCompiled();
+
+  // Compile Chunks
+  // Fills the free chunks of _compiled from the cursor. Thread context only.
+  void compileChunks();
+
+  // Play Compiled
+  // Reads the next step interval from _compiled. Called from Run_ISR()
+  // \return[int32_t] the next step interval (u-sec), 0 when the move is complete
+  int32_t playCompiled();
+
+  // Resume Live Ramp
+  // Sets a ramp to the step being played, so computeRampInterval() carries on from there
+  // \param[RampState&] ramp - _ramp, or a copy of it in a command
+  void resumeLiveRamp(RampState &ramp);
+
+  // Cancel Compiled
+  // Hands a compiled move back to the live ramp math before it is changed, by posting a command.
+  // Thread context only.
+  void cancelCompiled();
+
+  // Home ISR
+  // Edge interrupt of the limit switch, only latches _position. Run_ISR() stops the motor at the latch
+  void homeISR();
+
+  // Home Stop
+  // Decelerates the motor to a stop at the homing switch, once it is latched. Run_ISR() only
+  void homeStop();
+
+  // Reconcile Encoder
+  // Checks the encoder of this stepper, see reconcileEncoders(). Thread context only.
+  void reconcileEncoder();
+
+  // Correct Following
+  // Moves the steps the motor is behind (error > 0 moving CW), if it can be done without a jump in speed
+  // \param[i32] error - _position - encoder position (steps)
+  // \return[bool] false if the correction has to wait, ie while accelerating or decelerating
+  bool correctFollowing(int32_t error);
+
+  // Active settings, the temporary setting if one is set, otherwise the normal setting
+  Mode activeMode(){ return (_tempMode != NoChange) ? _tempMode : _mode; }
+  int32_t activeSpeed(){ return (_tempSpeed) ? _tempSpeed : _speed; }
+  uint32_t activeAcceleration(){ return (_tempAcceleration) ? _tempAcceleration : _acceleration; }
+
+  // Cruise Carry
+  // Adds the truncated fraction of the cruise interval to the carry, Bresenham style. Called from Run_ISR()
+  // \return[u8] 1 when the carry adds up to a whole u-sec, otherwise 0
+  static uint8_t cruiseCarry(RampState &ramp){
+    if(ramp.plan.cruiseRemainder == 0) return 0;
+    ramp.carry += ramp.plan.cruiseRemainder;
+    if(ramp.carry < ramp.plan.cruiseSpeed) return 0;
+    ramp.carry -= ramp.plan.cruiseSpeed;
+    return 1;
+  }
+
+  // Feed Interval
+  // Scales a step interval by the feed override, carrying the fraction so the scaled rate is exact.
+  // Called from Run_ISR()
+  // \param[i32] interval - the step interval (u-sec)
+  // \return[i32] the interval to schedule (u-sec)
+  int32_t feedInterval(int32_t interval){
+    uint32_t scale = VDW_Stepper::feedScale;
+    if(scale == (1UL << FEED_SCALE_SHIFT)) return interval;
+    uint64_t scaled = (uint64_t)interval * scale + _feedCarry;
+    _feedCarry = scaled & ((1UL << FEED_SCALE_SHIFT) - 1);
+    return scaled >> FEED_SCALE_SHIFT;
+  }
+
   void clearTemps();
+
+  // Finish Group
+  // Ends the coordinated move this stepper is the dominant axis of, once it has stopped. Thread context only,
+  // Run_ISR() calls StepperGroup::finish() itself
+  void finishGroup();
 };
 
 #endif
\ No newline at end of file
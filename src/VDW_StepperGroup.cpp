@@ -0,0 +1,112 @@
+#include "VDW_StepperGroup.h"
+
+bool StepperGroup::add(VDW_Stepper &stepper){
+  if(_numAxes >= STEPPER_GROUP_MAX_AXES) return false;
+  _axes[_numAxes++] = &stepper;
+  return true;
+}
+
+bool StepperGroup::moveAbsolute(const int32_t positions[], Mode mode, int32_t speed, uint32_t acceleration){
+  if(isRunning()) return false;
+  for(uint8_t i=0; i<_numAxes; i++){
+    if(_axes[i]->isRunning()) return false;
+  }
+
+  // Find the dominant axis
+  uint8_t dominantIndex = 0;
+  uint32_t dominantSteps = 0;
+  for(uint8_t i=0; i<_numAxes; i++){
+    uint32_t steps = abs(positions[i] - _axes[i]->_position);
+    if(steps > dominantSteps){
+      dominantSteps = steps;
+      dominantIndex = i;
+    }
+  }
+  if(dominantSteps == 0) return true;
+
+  // Setup the minor axes, starting halfway through the error term rounds steps to the nearest position on the line
+  _numMinor = 0;
+  for(uint8_t i=0; i<_numAxes; i++){
+    if(i == dominantIndex) continue;
+    StepperPtr axis = _axes[i];
+    axis->_target = positions[i];
+    axis->_hasTarget = true;
+    if(positions[i] == axis->_position) continue;
+    axis->_direction = (positions[i] > axis->_position);
+    axis->writeDirection(); // minor axes step with the dominant axis, set up their direction pins first
+    axis->enable();
+    axis->_minorAxis = true;
+    _minor[_numMinor] = axis;
+    _minorSteps[_numMinor] = abs(positions[i] - axis->_position);
+    _minorError[_numMinor] = dominantSteps / 2;
+    _numMinor++;
+  }
+
+  // Time the dominant axis
+  _dominant = _axes[dominantIndex];
+  _dominantSteps = dominantSteps;
+  _dominant->_group = this;
+  _dominant->moveAbsolute(positions[dominantIndex], mode, speed, acceleration);
+  if(!_dominant->isRunning()) finish(); // no speed set
+  return true;
+}
+
+bool StepperGroup::moveRelative(const int32_t distances[], Mode mode, int32_t speed, uint32_t acceleration){
+  int32_t positions[STEPPER_GROUP_MAX_AXES];
+  for(uint8_t i=0; i<_numAxes; i++){
+    positions[i] = _axes[i]->_position + distances[i];
+  }
+  return moveAbsolute(positions, mode, speed, acceleration);
+}
+
+void StepperGroup::stop(){
+  StepperPtr dominant = _dominant; // Run_ISR() may finish the move meanwhile
+  if(dominant == nullptr) return;
+  dominant->stop();
+
+  // Stopped dead, Run_ISR() takes the stop before the dominant axis steps again so no axis moves any more
+  if(dominant->_commands[dominant->_commandSeq & 1].stepInterval == 0) finish();
+}
+
+void StepperGroup::eStop(){
+  StepperPtr dominant = _dominant;
+  if(dominant) dominant->eStop(); // finishes the move
+  for(uint8_t i=0; i<_numAxes; i++){
+    if(_axes[i] != dominant) _axes[i]->eStop();
+  }
+}
+
+bool StepperGroup::isRunning(){
+  return _dominant != nullptr;
+}
+
+void StepperGroup::stepMinorAxes(){
+  for(uint8_t i=0; i<_numMinor; i++){
+    _minorError[i] += _minorSteps[i];
+    if(_minorError[i] >= _dominantSteps){
+      _minorError[i] -= _dominantSteps;
+      StepperPtr axis = _minor[i];
+      axis->stepOutput();
+#if defined(STEP_CAPTURE)
+      if(VDW_Stepper::capturing) VDW_Stepper::captureStep(axis->_slot, axis->_direction, 0); // on time with the dominant axis
+#endif
+      axis->_position += (axis->_direction) ? 1 : -1;
+    }
+  }
+}
+
+void StepperGroup::finish(){
+  // Run_ISR() may finish the move while the thread is in here. Once the dominant axis lets go of the group
+  // Run_ISR() does not touch it, before that it finishes the move whole
+  StepperPtr dominant = _dominant;
+  if(dominant == nullptr) return;
+  dominant->_group = nullptr;
+  MemoryBarrier();
+
+  // Targets of a stopped move become where the axes ended up
+  for(uint8_t i=0; i<_numMinor; i++){
+    _minor[i]->_target = _minor[i]->_position;
+    _minor[i]->_minorAxis = false;
+  }
+  _dominant = nullptr;
+}
@@ -0,0 +1,77 @@
+#ifndef VDW_STEPPER_GROUP_H
+#define VDW_STEPPER_GROUP_H
+
+#include "VDW_Stepper.h"
+
+#define STEPPER_GROUP_MAX_AXES 6
+
+// Coordinated linear moves of several steppers
+// All axes start and finish together along a straight line. Only the axis with the most steps
+// (the dominant axis) is timed by Run_ISR(), the other axes are stepped from the dominant axis'
+// steps using Bresenham's line algorithm, so a coordinated move costs one interrupt per dominant step.
+class StepperGroup
+{
+  friend class VDW_Stepper;
+
+public:
+
+  // Add
+  // Adds a stepper to the group. Axes are ordered in the order they are added.
+  // \param[VDW_Stepper&] stepper - the stepper to add
+  // \return[bool] false if the group is full
+  bool add(VDW_Stepper &stepper);
+
+  // Move Absolute
+  // Move all axes to new target positions along a straight line.
+  // Speed and acceleration apply to the dominant axis (the axis with the most steps to go).
+  // Using any of the optional parameters does NOT overide the dominant axis' settings.
+  // \param[const i32*] positions - the new target positions, one per axis (steps)
+  // \param[Mode] mode - the mode of the dominant axis. Constant Speed, Accelerations or SCurve [optional]
+  // \param[i32] speed - the speed of the dominant axis (mSteps/sec) [optional]
+  // \param[u32] acceleration - the acceleration of the dominant axis (mSteps/sec^2) [optional]
+  // \return[bool] false if any axis is still running
+  bool moveAbsolute(const int32_t positions[], Mode mode=NoChange, int32_t speed=0, uint32_t acceleration=0);
+
+  // Move Relative
+  // Move all axes by distances relative to their current positions along a straight line.
+  // \param[const i32*] distances - the distances to move, one per axis (steps)
+  // \return[bool] false if any axis is still running
+  bool moveRelative(const int32_t distances[], Mode mode=NoChange, int32_t speed=0, uint32_t acceleration=0);
+
+  // Stop
+  // Stops the group along the line using the dominant axis' stop(). A stop without deceleration (Constant
+  // Speed) ends the move at once, a decelerating stop ends it when the dominant axis stops
+  void stop();
+
+  // E-Stop
+  // Stops every axis immediately with its eStop() and ends the move
+  void eStop();
+
+  // Is Running
+  // Minor axes' isRunning() is also true until the move ends
+  // \return[bool] true if a coordinated move is in progress
+  bool isRunning();
+
+private:
+  StepperPtr _axes[STEPPER_GROUP_MAX_AXES];
+  uint8_t _numAxes = 0;
+
+  // MOVE DATA
+  volatile StepperPtr _dominant = nullptr; // the timed axis of the current move, cleared by finish()
+  uint32_t _dominantSteps = 0; // steps the dominant axis moves
+  StepperPtr _minor[STEPPER_GROUP_MAX_AXES - 1]; // the other axes with steps to take
+  uint32_t _minorSteps[STEPPER_GROUP_MAX_AXES - 1]; // steps each minor axis moves
+  uint32_t _minorError[STEPPER_GROUP_MAX_AXES - 1]; // Bresenham error accumulators
+  uint8_t _numMinor = 0;
+
+  // Step Minor Axes
+  // Called from Run_ISR() after every dominant axis step
+  void stepMinorAxes();
+
+  // Finish
+  // Ends the move, called from Run_ISR() when the dominant axis stops, or from the thread when it is stopped
+  // there. Safe to call again on a finished group
+  void finish();
+};
+
+#endif
@@ -0,0 +1,168 @@
+#include "VDW_StepperStream.h"
+
+// Little-endian field access
+static int32_t readInt32(const uint8_t *data){
+  return (int32_t)((uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24));
+}
+
+static void writeInt32(uint8_t *data, int32_t value){
+  data[0] = value;
+  data[1] = value >> 8;
+  data[2] = value >> 16;
+  data[3] = value >> 24;
+}
+
+bool StepperStream::add(VDW_Stepper &stepper){
+  if(_numSteppers >= STREAM_MAX_STEPPERS) return false;
+  _credits[_numSteppers] = 0;
+  _steppers[_numSteppers++] = &stepper;
+  return true;
+}
+
+void StepperStream::begin(Stream &stream){
+  _stream = &stream;
+  _held = 0;
+}
+
+void StepperStream::update(){
+  if(_stream == nullptr) return;
+
+  // Decode what has arrived, a byte at a time straight into the partial frame
+  int available = _stream->available();
+  while(available-- > 0){
+    int value = _stream->read();
+    if(value < 0) break;
+    uint8_t byte = value;
+    feed(&byte, 1);
+  }
+
+  // Grant the queue slots that have come free
+  for(uint8_t i=0; i<_numSteppers; i++){
+    uint8_t free = _steppers[i]->queueAvailable();
+    if(free > _credits[i]){
+      reply(STREAM_REPLY_CREDIT, i, free - _credits[i]);
+      _credits[i] = free;
+    }
+  }
+}
+
+uint32_t StepperStream::feed(const uint8_t *data, size_t length){
+  uint32_t frames = 0;
+  while(length > 0){
+    if(_held == 0){
+      // Skip to the start of a frame
+      if(*data != STREAM_START){
+        data++;
+        length--;
+        continue;
+      }
+
+      // Whole frames are decoded in place
+      if(length >= STREAM_FRAME_SIZE){
+        if(decode(data)){
+          frames++;
+          data += STREAM_FRAME_SIZE;
+          length -= STREAM_FRAME_SIZE;
+        }else{
+          data++; // resynchronize on the next STREAM_START
+          length--;
+        }
+        continue;
+      }
+    }
+
+    // Hold the start of a frame split across calls
+    _frame[_held++] = *data++;
+    length--;
+    if(_held < STREAM_FRAME_SIZE) continue;
+    if(decode(_frame)){
+      frames++;
+      _held = 0;
+      continue;
+    }
+
+    // Resynchronize on the next STREAM_START inside the held bytes
+    uint8_t start = 1;
+    while(start < STREAM_FRAME_SIZE && _frame[start] != STREAM_START) start++;
+    _held = STREAM_FRAME_SIZE - start;
+    memmove(_frame, _frame + start, _held);
+  }
+  return frames;
+}
+
+bool StepperStream::decode(const uint8_t *frame){
+  if(crc8(frame, STREAM_FRAME_SIZE - 1) != frame[STREAM_FRAME_SIZE - 1]){
+    // Report the first bad frame, not every STREAM_START found while resynchronizing
+    _checksumErrors += 1;
+    if(_synchronized) reply(STREAM_REPLY_ERROR, STREAM_NO_STEPPER, STREAM_ERROR_CHECKSUM);
+    _synchronized = false;
+    return false;
+  }
+  _synchronized = true;
+  _frames += 1;
+
+  uint8_t command = frame[1] & 0x0F;
+  uint8_t mode = frame[1] >> 4;
+  uint8_t stepper = frame[2];
+
+  // A new session, credits the host held are void
+  if(command == STREAM_SYNC){
+    for(uint8_t i=0; i<_numSteppers; i++) _credits[i] = 0;
+    reply(STREAM_REPLY_SYNC, STREAM_NO_STEPPER, 0);
+    return true;
+  }
+
+  if(stepper >= _numSteppers){
+    reply(STREAM_REPLY_ERROR, stepper, STREAM_ERROR_STEPPER);
+    return true;
+  }
+
+  switch(command){
+    case STREAM_MOVE:
+      if(mode > SCurve){
+        reply(STREAM_REPLY_ERROR, stepper, STREAM_ERROR_COMMAND);
+        break;
+      }
+      if(_credits[stepper] > 0) _credits[stepper]--;
+      if(!_steppers[stepper]->queueMove(readInt32(frame + 3), (Mode)mode, readInt32(frame + 7), readInt32(frame + 11))){
+        reply(STREAM_REPLY_ERROR, stepper, STREAM_ERROR_FULL);
+      }
+      break;
+    case STREAM_STOP:
+      _steppers[stepper]->stop();
+      break;
+    default:
+      reply(STREAM_REPLY_ERROR, stepper, STREAM_ERROR_COMMAND);
+  }
+  return true;
+}
+
+void StepperStream::reply(StreamReply type, uint8_t stepper, int32_t value){
+  if(_stream == nullptr) return;
+  uint8_t reply[STREAM_REPLY_SIZE];
+  reply[0] = STREAM_START;
+  reply[1] = type;
+  reply[2] = stepper;
+  writeInt32(reply + 3, value);
+  reply[7] = crc8(reply, STREAM_REPLY_SIZE - 1);
+  _stream->write(reply, STREAM_REPLY_SIZE);
+}
+
+void StepperStream::encodeFrame(uint8_t *frame, StreamCommand command, uint8_t stepper, int32_t target, Mode mode, int32_t speed, uint32_t acceleration){
+  frame[0] = STREAM_START;
+  frame[1] = command | (mode << 4);
+  frame[2] = stepper;
+  writeInt32(frame + 3, target);
+  writeInt32(frame + 7, speed);
+  writeInt32(frame + 11, acceleration);
+  frame[15] = crc8(frame, STREAM_FRAME_SIZE - 1);
+}
+
+uint8_t StepperStream::crc8(const uint8_t *data, size_t length){
+  uint8_t crc = 0;
+  while(length--){
+    crc ^= *data++;
+    for(uint8_t bit=0; bit<8; bit++) crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+  }
+  return crc;
+}
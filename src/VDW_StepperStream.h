@@ -0,0 +1,117 @@
+#ifndef VDW_STEPPER_STREAM_H
+#define VDW_STEPPER_STREAM_H
+
+#include "VDW_Stepper.h"
+
+#define STREAM_MAX_STEPPERS 8
+#define STREAM_START 0xA5 // first byte of every frame and reply
+#define STREAM_FRAME_SIZE 16
+#define STREAM_REPLY_SIZE 8
+#define STREAM_NO_STEPPER 0xFF // stepper of replies that are not about a stepper
+
+// Stream Frames
+// Host to controller, 16 bytes, little-endian:
+//   [0]     STREAM_START
+//   [1]     command (low nibble) | mode << 4 (Mode, MOVE only)
+//   [2]     stepper, the order it was added to the StepperStream
+//   [3-6]   target position (i32, steps)
+//   [7-10]  speed (i32, mSteps/sec), 0 == the stepper's speed
+//   [11-14] acceleration (u32, mSteps/sec^2), 0 == the stepper's acceleration
+//   [15]    CRC-8 (polynomial 0x07) of bytes 0 to 14
+enum StreamCommand{
+  STREAM_MOVE = 1, // queueMove() the target
+  STREAM_STOP = 2, // stop() the stepper, clears its queue
+  STREAM_SYNC = 3, // start of a session: the host resets its credits, the controller grants them again
+};
+
+// Stream Replies
+// Controller to host, 8 bytes, little-endian:
+//   [0]     STREAM_START
+//   [1]     reply
+//   [2]     stepper, STREAM_NO_STEPPER if not about a stepper
+//   [3-6]   value (i32)
+//   [7]     CRC-8 of bytes 0 to 6
+enum StreamReply{
+  STREAM_REPLY_CREDIT = 1, // value more moves can be sent to the stepper
+  STREAM_REPLY_SYNC = 2, // the STREAM_SYNC was received, credits from before it are void
+  STREAM_REPLY_ERROR = 3, // value is a StreamError
+};
+
+enum StreamError{
+  STREAM_ERROR_CHECKSUM = 1, // a frame failed its CRC, the stream resynchronizes on the next STREAM_START
+  STREAM_ERROR_STEPPER = 2, // no stepper with that number
+  STREAM_ERROR_COMMAND = 3, // unknown command or mode
+  STREAM_ERROR_FULL = 4, // the move queue was full, the move was dropped (sent without a credit)
+};
+
+// Binary move stream
+// Decodes fixed size binary frames from a host into the move queues of its steppers (queueMove()),
+// far cheaper than parsing text commands. Flow control is by credits: each credit is one free slot in a
+// stepper's move queue. The host starts with none, sends STREAM_SYNC and then sends a MOVE for a stepper only
+// while it holds a credit for it. update() grants credits back as Run_ISR() takes moves off the queues.
+class StepperStream
+{
+public:
+
+  // Add
+  // Adds a stepper to the stream. Steppers are numbered in the order they are added.
+  // \param[VDW_Stepper&] stepper - the stepper to add
+  // \return[bool] false if the stream is full
+  bool add(VDW_Stepper &stepper);
+
+  // Begin
+  // \param[Stream&] stream - where frames are read from and replies are written to, ie Serial
+  void begin(Stream &stream);
+
+  // Update
+  // Decodes every byte that has arrived, without waiting for more, then grants credits for the queue
+  // slots that have come free. Call from loop().
+  void update();
+
+  // Feed
+  // Decodes frames from a buffer, ie one filled by DMA. Whole frames are decoded where they are, only
+  // a frame split across calls is copied. Replies go to the stream given to begin().
+  // \param[const u8*] data - the received bytes
+  // \param[size_t] length - the number of bytes
+  // \return[u32] the number of frames decoded
+  uint32_t feed(const uint8_t *data, size_t length);
+
+  // Getters
+  uint32_t framesDecoded(){ return _frames; }
+  uint32_t checksumErrors(){ return _checksumErrors; }
+
+  // Encode Frame
+  // Fills a frame, for hosts and tests built with the library
+  // \param[u8*] frame - STREAM_FRAME_SIZE bytes
+  static void encodeFrame(uint8_t *frame, StreamCommand command, uint8_t stepper, int32_t target=0, Mode mode=NoChange, int32_t speed=0, uint32_t acceleration=0);
+
+  // CRC-8
+  // \return[u8] the CRC-8 (polynomial 0x07, initial value 0) of data
+  static uint8_t crc8(const uint8_t *data, size_t length);
+
+private:
+  StepperPtr _steppers[STREAM_MAX_STEPPERS];
+  uint8_t _numSteppers = 0;
+  uint8_t _credits[STREAM_MAX_STEPPERS]; // credits the host holds for each stepper
+  Stream* _stream = nullptr;
+
+  // PARTIAL FRAME
+  uint8_t _frame[STREAM_FRAME_SIZE]; // bytes of a frame split across feed() calls
+  uint8_t _held = 0; // bytes in _frame
+
+  // STATISTICS
+  uint32_t _frames = 0;
+  uint32_t _checksumErrors = 0;
+  bool _synchronized = true; // false after a checksum error until a frame decodes
+
+  // Decode
+  // Runs one frame that starts with STREAM_START
+  // \return[bool] false if the frame failed its CRC
+  bool decode(const uint8_t *frame);
+
+  // Reply
+  // Writes a reply to the stream
+  void reply(StreamReply type, uint8_t stepper, int32_t value);
+};
+
+#endif
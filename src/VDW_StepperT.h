@@ -0,0 +1,28 @@
+#ifndef VDW_STEPPER_T_H
+#define VDW_STEPPER_T_H
+
+#include "VDW_Stepper.h"
+
+// Stepper with compile-time step/direction pins
+// A VDW_Stepper driven through its pins (see initPins()) with the pins fixed at compile time, ie:
+//   VDW_StepperT<D0, D1, D2> myStepper;
+// Steps are written by Run_ISR() straight to the GPIO port registers along with every other pin stepper
+// due in the same pass, there is no step function or lambda to call. It shares Run_ISR() and all of the
+// VDW_Stepper API with function pointer steppers.
+// \param StepPin - the step pin
+// \param DirPin - the direction pin, high == CW
+// \param EnablePin - the enable pin, active low. -1 == no enable pin [optional]
+template<uint16_t StepPin, uint16_t DirPin, int16_t EnablePin = -1>
+class VDW_StepperT : public VDW_Stepper
+{
+  static_assert(StepPin != DirPin, "VDW_StepperT: the step and direction pins must be different");
+  static_assert(EnablePin < 0 || (EnablePin != StepPin && EnablePin != DirPin), "VDW_StepperT: the enable pin must be different from the step and direction pins");
+
+public:
+  // Init
+  // Sets up the pins. Call from setup(), before moving the motor.
+  // \return[bool] false if the pins are on more than MAX_STEP_PORTS ports
+  bool init(){ return initPins(StepPin, DirPin, EnablePin); }
+};
+
+#endif